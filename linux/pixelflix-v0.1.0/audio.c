@@ -1,15 +1,47 @@
 #include "audio.h"
 #include "player.h"
+#include "demux.h"
 #include "logger.h"
 #include "queue.h"
+#include "ring.h"
+#include "convert.h"
+#include "biquad.h"
+#include "rtcheck.h"
+#include "mix.h"
+#include "loudness.h"
+#include "dsp.h"
 #include "SDL2/SDL.h"
 #include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <math.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
 
 
 #define Packet_QUEUE_SIZE UINT32_MAX
-#define AUDIO_BUFFER_SIZE 1024 // how many samples the audio_buf has
+//device buffer and ring depth start small (~10 ms output latency at 48 kHz) and
+//double on underruns, ring first, up to the maximums
+#define AUDIO_BUFFER_MIN 128 //device buffer, sample frames, a power of 2
+#define AUDIO_BUFFER_MAX 4096
+#define AUDIO_RING_MIN 2 //PCM ring fill limit, in device buffers
+#define AUDIO_RING_MAX 16
+#define AUDIO_ADAPT_INTERVAL 0.5 //seconds between two underrun checks
+#define AUDIO_STABLE_MIN 10.0 //seconds without underruns before shrinking again
+#define AUDIO_STABLE_MAX 300.0 //the wait doubles each time a shrink caused underruns
 #define MAX_AUDIO_FRAME_SIZE 192000 //how many bytes
 #define SDL_USERVENT_REFRESH (SDL_USEREVENT+1)
+#ifndef AUDIO_WARMUP_PACKETS
+#define AUDIO_WARMUP_PACKETS 500 //packets after a start, seek, track change or stream switch before the audio path must stop allocating
+#endif
+#define AUDIO_STATS_INTERVAL 10.0 //seconds between two callback reports
+#define AUDIO_DRIFT_AVG_NB 20 //frames averaged by the drift estimator
+#define AUDIO_DRIFT_THRESHOLD 0.005 //seconds of averaged drift before correcting
+#define AUDIO_DRIFT_HORIZON 2.0 //seconds over which a drift is pulled back
+#define AUDIO_DRIFT_MAX_RATIO 0.002 //max speed change, ~3.5 cents: below audible pitch
+#define AUDIO_DRIFT_SMOOTH 0.05 //low-pass of the speed change, per frame
+#define AUDIO_DRIFT_NOSYNC 10.0 //larger differences are discontinuities, not drift
 
 // exit
 int exitCase(const char* c)
@@ -19,186 +51,847 @@ int exitCase(const char* c)
 }
 
 
+//upper bounds of the callback time histogram, in percent of the buffer duration; the last bucket is over budget
+static const int audio_stats_bounds[AUDIO_STATS_BUCKETS - 1] = { 1 , 2 , 5 , 10 , 25 , 50 , 100 };
 
-static FFAudioParas srcParas;
-static FFAudioParas tgtParas;
-static bool isStreamFinished = false;
-static bool isAudioDecodeFinished = false;
-static bool isVideoDecodeFinished = false;
-static struct SwrContext* swrCtx;
-static bool signal = false;
+static int audioDriftCorrection(PlayerStatus* ps , int nb_samples);
+static SDL_AudioFormat audioSdlFormat(enum AVSampleFormat fmt);
+void audioCallback(void* userdata , uint8_t* stream , int len);
+static int audioDecodePacket(PlayerStatus* ps , AVPacket* pkt , AVFrame* pf);
 
-//resampling
-static uint8_t* resample_buf = NULL;
-static unsigned int resample_buf_len = 0;
+//convert one decoded frame to the SDL format
+//return the converted size in bytes and point *out at it, negative on failure
+static int audioConvertFrame(PlayerStatus* ps , AVFrame* pf , uint8_t** out)
+{
+    FFAudioParas* srcParas = &ps->srcParas;
+    FFAudioParas* tgtParas = &ps->tgtParas;
+    enum AVSampleFormat fmt = (enum AVSampleFormat)pf->format;
+    int nb_samples , delta;
+    // drift correction goes through swresample even when nothing else needs it
+    bool compensate = ps->master != SYNC_AUDIO;
 
+    // SDL took the decoder's rate and layout: no resampler, at most a planar -> interleaved copy
+    if (!compensate && pf->sample_rate == tgtParas->freq && pf->channels == tgtParas->channels &&
+        av_get_packed_sample_fmt(fmt) == tgtParas->fmt)
+    {
+        if (!av_sample_fmt_is_planar(fmt))
+        {
+            *out = pf->data[0];
+            return pf->nb_samples * pf->channels * av_get_bytes_per_sample(fmt);
+        }
+        if ((unsigned int)(pf->nb_samples * pf->channels * av_get_bytes_per_sample(fmt)) > ps->resample_buf_len)
+        {
+            av_fast_malloc(&ps->resample_buf , &ps->resample_buf_len , pf->nb_samples * pf->channels * av_get_bytes_per_sample(fmt));
+            if (!ps->resample_buf) return AVERROR(ENOMEM);
+        }
+        *out = ps->resample_buf;
+        return convertInterleave(ps->resample_buf , (const uint8_t* const*)pf->extended_data , pf->nb_samples , pf->channels , av_get_bytes_per_sample(fmt));
+    }
 
-//audio decode packet
-//positive number on success, means the frame size that decoded
-//-1 on failure
-//usually av_send_packet to codec then receive frame from
-int audioDecodePacket(AVCodecContext* ctx , AVPacket* pkt , uint8_t* audio_buf , int buf_size)
+    // same rate: sample format changes and downmixes go through the SIMD kernels,
+    // swresample is only left for a real sample rate change
+    if (!compensate && pf->sample_rate == tgtParas->freq &&
+        convertSetup(&ps->conv , fmt ,
+            pf->channel_layout ? (int64_t)pf->channel_layout : av_get_default_channel_layout(pf->channels) , pf->channels ,
+            tgtParas->fmt , tgtParas->channels , ps->opts.dither))
+    {
+        int size = pf->nb_samples * tgtParas->channels * av_get_bytes_per_sample(tgtParas->fmt);
+        if ((unsigned int)size > ps->resample_buf_len)
+        {
+            av_fast_malloc(&ps->resample_buf , &ps->resample_buf_len , size);
+            if (!ps->resample_buf) return AVERROR(ENOMEM);
+        }
+        *out = ps->resample_buf;
+        return convertRun(&ps->conv , ps->resample_buf , (const uint8_t* const*)pf->extended_data , pf->nb_samples);
+    }
+
+    // tgtParas是SDL可接受的音频参数，是openAudio()中取得的参数
+    // 在openAudio()函数中又有“srcParas = tgtParas”
+    // 此处表示：如果frame中的音频参数 == srcParas == tgtParas，那音频重采样的过程就免了(因此时swrCtx是NULL)
+    // 否则使用frame(源)和tgtParas(目标)中的音频参数来设置swrCtx，并使用frame中的音频参数来赋值srcParas
+    if (pf->format != srcParas->fmt ||
+        (int64_t)pf->channel_layout != srcParas->channel_layout ||
+        pf->sample_rate != srcParas->freq ||
+        (compensate && ps->swrCtx == NULL))
+    {
+        swr_free(&ps->swrCtx);
+        ps->swrCtx = swr_alloc_set_opts(NULL ,
+            tgtParas->channel_layout ,
+            tgtParas->fmt ,
+            tgtParas->freq ,
+            pf->channel_layout ,
+            (enum AVSampleFormat)pf->format ,
+            pf->sample_rate ,
+            0 ,
+            NULL);
+        // keep the resampler in the chain so compensation never reinitializes it
+        if (ps->swrCtx && compensate) av_opt_set_int(ps->swrCtx , "flags" , SWR_FLAG_RESAMPLE , 0);
+
+        if (ps->swrCtx == NULL || swr_init(ps->swrCtx) < 0)
+        {
+            logger(LOG , "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!" ,
+                pf->sample_rate , av_get_sample_fmt_name((enum AVSampleFormat)pf->format) , pf->channels ,
+                tgtParas->freq , av_get_sample_fmt_name(tgtParas->fmt) , tgtParas->channels);
+            swr_free(&ps->swrCtx);
+            return -1;
+        }
+
+        // 使用frame中的参数更新srcParas，第一次更新后后面基本不用执行此if分支了，因为一个音频流中各frame通用参数一样
+        srcParas->channel_layout = pf->channel_layout;
+        srcParas->channels = pf->channels;
+        srcParas->freq = pf->sample_rate;
+        srcParas->fmt = (enum AVSampleFormat)pf->format;
+    }
+
+    if (ps->swrCtx == NULL)    // 不重采样
+    {
+        *out = pf->data[0];
+        return av_samples_get_buffer_size(NULL , pf->channels , pf->nb_samples , (enum AVSampleFormat)pf->format , 1);
+    }
+
+    // 重采样
+    const uint8_t** in = (const uint8_t**)pf->extended_data;
+    // 漂移校正：按输出采样率换算，加减的样本分摊在这一帧上
+    if (compensate)
+    {
+        delta = audioDriftCorrection(ps , pf->nb_samples);
+        if (swr_set_compensation(ps->swrCtx ,
+            (int64_t)delta * tgtParas->freq / pf->sample_rate ,
+            delta ? (int64_t)(pf->nb_samples + delta) * tgtParas->freq / pf->sample_rate : 0) < 0)
+            logger(LOG , "swr_set_compensation() failed");
+    }
+    // 重采样输出参数：输出音频样本数(多加了256个样本)
+    int out_count = (int64_t)pf->nb_samples * tgtParas->freq / pf->sample_rate + 256;
+    // 重采样输出参数：输出音频缓冲区尺寸(以字节为单位)
+    int out_size = av_samples_get_buffer_size(NULL , tgtParas->channels , out_count , tgtParas->fmt , 0);
+    if (out_size < 0)
+    {
+        logger(LOG , "av_samples_get_buffer_size() failed");
+        return -1;
+    }
+    // resample_buf is allocated for MAX_AUDIO_FRAME_SIZE when the stream is opened, only an unusually big frame grows it
+    if ((unsigned int)out_size > ps->resample_buf_len)
+    {
+        av_fast_malloc(&ps->resample_buf , &ps->resample_buf_len , out_size);
+    }
+    if (ps->resample_buf == NULL)
+    {
+        return AVERROR(ENOMEM);
+    }
+    // 音频重采样：返回值是重采样后得到的音频数据中单个声道的样本数
+    nb_samples = swr_convert(ps->swrCtx , &ps->resample_buf , out_count , in , pf->nb_samples);
+    if (nb_samples < 0)
+    {
+        logger(LOG , "swr_convert() failed");
+        return -1;
+    }
+    if (nb_samples == out_count)
+    {
+        logger(LOG , "audio buffer is probably too small");
+        if (swr_init(ps->swrCtx) < 0)
+            swr_free(&ps->swrCtx);
+    }
+
+    // 重采样返回的一帧音频数据大小(以字节为单位)
+    *out = ps->resample_buf;
+    return nb_samples * tgtParas->channels * av_get_bytes_per_sample(tgtParas->fmt);
+}
+
+//the audio clock: pts audible right now, NAN until the callback played something
+double audioGetClock(PlayerStatus* ps)
 {
-    AVFrame* pf = av_frame_alloc();
-    if (!pf) exitCase("Failed to allocate AVFrame.");
-    int res = 0;
-    int nb_samples;
-    uint8_t* p_cp_buf = NULL;
-    int cp_len;
-    int frm_size = 0;
-    bool resend = true;
+    return playerClockGet(ps , &ps->audioClock);
+}
+
+//samples to add (+) or drop (-) from a frame of nb_samples to pull the audio clock
+//onto the master clock when audio isn't the master. The averaged difference becomes a speed change that is
+//clamped below audible pitch and low-passed, so corrections never step
+static int audioDriftCorrection(PlayerStatus* ps , int nb_samples)
+{
+    AudioDrift* d = &ps->drift;
+    double audio = audioGetClock(ps);
+    double diff , avg , target = 0;
+    int delta;
+
+    if (isnan(audio)) return 0;
+    playerStartClock(ps , audio);
+    diff = atomic_load(&ps->audioClock.drift);
+    if (fabs(diff) > AUDIO_DRIFT_NOSYNC)
+    {
+        //a jump, not a drift: start over
+        d->cum = 0;
+        d->count = 0;
+        d->ratio = 0;
+        d->carry = 0;
+        return 0;
+    }
+    d->cum = diff + d->coef * d->cum;
+    if (d->count < AUDIO_DRIFT_AVG_NB) d->count++;
+    else
+    {
+        avg = d->cum * (1.0 - d->coef);
+        if (fabs(avg) >= AUDIO_DRIFT_THRESHOLD)
+            target = av_clipd(avg / AUDIO_DRIFT_HORIZON , -AUDIO_DRIFT_MAX_RATIO , AUDIO_DRIFT_MAX_RATIO);
+    }
+    d->ratio += AUDIO_DRIFT_SMOOTH * (target - d->ratio);
+    d->carry += d->ratio * nb_samples;
+    delta = (int)d->carry;
+    d->carry -= delta;
+    return delta;
+}
+
+//hand converted PCM to the callback, waiting while the ring holds adapt.limit bytes.
+//A seek made while paused drops what is left: the callback is stopped, nothing makes room
+static void audioWriteRing(PlayerStatus* ps , const uint8_t* data , int len)
+{
+    size_t n , fill;
+    int seek;
+    while (len > 0)
+    {
+        //drain stale wakeups first, any read after this point posts again
+        while (sem_trywait(&ps->pcmSpace) == 0);
+        fill = ringFill(&ps->pcm);
+        n = fill < ps->adapt.limit ? ringWrite(&ps->pcm , data , FFMIN((size_t)len , ps->adapt.limit - fill)) : 0;
+        data += n;
+        len -= n;
+        seek = atomic_load(&ps->pausedSeek);
+        if (seek > 0 && seek != ps->audioSerial) break;
+        if (len > 0) sem_wait(&ps->pcmSpace);
+    }
+}
+
+static void audioEmit(void* opaque , const uint8_t* data , int len)
+{
+    PlayerStatus* ps = (PlayerStatus*)opaque;
+    //the analyzer sees the same bytes at the same positions as the ring
+    if (ps->opts.visualize) spectrumWrite(&ps->spectrum , data , len);
+    audioWriteRing(ps , data , len);
+}
+
+//spectrum analyzer thread: idle priority, follows the ring's read position so the
+//bands match what is being heard, a hop at a time. The callback does nothing for it
+static void* audioAnalyze(void* arg)
+{
+    PlayerStatus* ps = (PlayerStatus*)arg;
+    int64_t nap = (int64_t)SPECTRUM_HOP * 1000000 / ps->tgtParas.freq / 2;
+    spectrumLowerPriority();
+    while (!(ps->isAudioDecodeFinished && ringFill(&ps->pcm) == 0))
+    {
+        playerWaitPaused(ps);
+        spectrumStep(&ps->spectrum , atomic_load(&ps->pcm.rpos));
+        av_usleep(nap);
+    }
+    return NULL;
+}
 
-    while (resend)
+//the output latency the current sizes give: the ring, SDL's two buffers and the device
+static double audioOutputLatency(PlayerStatus* ps)
+{
+    return (double)(ps->adapt.depth + 2) * ps->adapt.samples / ps->tgtParas.freq + ps->opts.audioLatency;
+}
+
+//reopen the device with another buffer size in the same format, SDL converts if it must.
+//The ring keeps its PCM, only the little SDL itself buffered is lost.
+//Runs under the pause lock, a pause meanwhile leaves the new device stopped
+static void audioReopen(PlayerStatus* ps , int samples)
+{
+    SDL_AudioSpec spec;
+    memset(&spec , 0 , sizeof(spec));
+    spec.freq = ps->tgtParas.freq;
+    spec.format = audioSdlFormat(ps->tgtParas.fmt);
+    spec.channels = ps->tgtParas.channels;
+    spec.samples = samples;
+    spec.callback = audioCallback;
+    spec.userdata = ps;
+    pthread_mutex_lock(&ps->pauseLock);
+    SDL_CloseAudio();
+    if (SDL_OpenAudio(&spec , NULL))
+    {
+        logger(LOG , "Failed to reopen audio device with %d samples: %s" , samples , SDL_GetError());
+        spec.samples = ps->adapt.samples;
+        if (SDL_OpenAudio(&spec , NULL)) logger(EXIT_FAILURE , "Failed to open audio device.");
+    }
+    ps->adapt.samples = spec.samples;
+    ps->astats.budget = (double)spec.samples / spec.freq;
+    if (!atomic_load(&ps->paused)) SDL_PauseAudio(0);
+    pthread_mutex_unlock(&ps->pauseLock);
+}
+
+//grow the ring, then the device buffer, on underruns; shrink the ring, then the device
+//buffer, after a stable period. A shrink that brings underruns back doubles the period
+static void audioAdapt(PlayerStatus* ps)
+{
+    AudioAdapt* a = &ps->adapt;
+    double now = playerGetTime();
+    double paused = atomic_load(&ps->pausedTotal);
+    uint64_t underruns = atomic_load_explicit(&ps->astats.underruns , memory_order_relaxed);
+    int depth = a->depth , samples = a->samples;
+
+    //reopening the device would restart it, and no underrun can happen while paused
+    if (atomic_load(&ps->paused)) return;
+    a->since += paused - a->paused;
+    a->paused = paused;
+    if (now - a->checked < AUDIO_ADAPT_INTERVAL) return;
+    a->checked = now;
+    if (underruns > a->underruns)
+    {
+        if (a->shrunk) a->stable = FFMIN(a->stable * 2 , AUDIO_STABLE_MAX);
+        if (depth < AUDIO_RING_MAX) depth *= 2;
+        else if (samples < AUDIO_BUFFER_MAX) samples *= 2;
+        a->underruns = underruns;
+        a->shrunk = false;
+        a->since = now;
+    }
+    else if (now - a->since >= a->stable)
+    {
+        if (depth > AUDIO_RING_MIN) depth /= 2;
+        else if (samples > AUDIO_BUFFER_MIN) samples /= 2;
+        a->shrunk = depth != a->depth || samples != a->samples;
+        a->since = now;
+    }
+    if (depth == a->depth && samples == a->samples) return;
+
+    if (samples != a->samples) audioReopen(ps , samples);
+    a->depth = depth;
+    a->limit = (size_t)a->depth * a->samples * ps->tgtParas.frame_size;
+    logger(LOG , "Audio buffers: device %d samples, ring %d buffers, output latency %.1f ms." ,
+        a->samples , a->depth , audioOutputLatency(ps) * 1000);
+}
+
+//drop the part of the converted frame that ends at audioNextPts and lies outside
+//[trimStart, trimEnd): a seek's lead-in from the packet before the target, encoder delay and padding
+//return the bytes left, *buf is moved past the dropped head
+static int audioTrim(PlayerStatus* ps , uint8_t** buf , int len)
+{
+    int frame_size = ps->tgtParas.frame_size;
+    int frames = len / frame_size;
+    int head = 0 , keep = frames;
+    double start = ps->audioNextPts - (double)frames / ps->tgtParas.freq;
+    if (!isnan(ps->trimStart) && start < ps->trimStart)
+        head = (int)FFMIN(lrint((ps->trimStart - start) * ps->tgtParas.freq) , frames);
+    if (!isnan(ps->trimEnd) && ps->audioNextPts > ps->trimEnd)
+        keep = (int)FFMAX(FFMIN(lrint((ps->trimEnd - start) * ps->tgtParas.freq) , frames) , 0);
+    if (keep <= head) return 0;
+    *buf += head * frame_size;
+    return (keep - head) * frame_size;
+}
+
+//playlist time right after the last sample that was kept
+static double audioTrimmedEnd(PlayerStatus* ps)
+{
+    return isnan(ps->trimEnd) ? ps->audioNextPts : FFMIN(ps->audioNextPts , ps->trimEnd);
+}
+
+//the demuxer seeked: drop what the decoder, the resampler, the stretcher and the ring
+//still hold and trim the first frames up to the target, so playback starts on its sample.
+//The PCM from here on is stamped with the seek's serial, the audio clock runs on it once heard
+static void audioSeek(PlayerStatus* ps , double target , int serial)
+{
+    avcodec_flush_buffers(ps->track.codecCtx);
+    if (atomic_load(&ps->switchPending))
+    {
+        avcodec_flush_buffers(ps->switchTrack.codecCtx);
+        ps->switchWarmed = 0;
+    }
+    for (int i = 0; i < ps->nbMix; i++)
+    {
+        avcodec_flush_buffers(ps->mix[i].track.codecCtx);
+        if (ps->mix[i].swrCtx && swr_init(ps->mix[i].swrCtx) < 0) swr_free(&ps->mix[i].swrCtx);
+        ringSkip(&ps->mix[i].fifo , ringFill(&ps->mix[i].fifo));
+        ps->mix[i].pts = NAN;
+    }
+    if (ps->opts.mixTracks > 0) ringSkip(&ps->mixHold , ringFill(&ps->mixHold));
+    if (ps->swrCtx && swr_init(ps->swrCtx) < 0) swr_free(&ps->swrCtx);
+    stretchReset(&ps->stretch);
+    memset(&ps->drift , 0 , sizeof(ps->drift));
+    ps->drift.coef = exp(log(0.01) / AUDIO_DRIFT_AVG_NB);
+    ps->audioNextPts = target;
+    ps->trimStart = target;
+    atomic_store(&ps->pcmFlush , atomic_load(&ps->pcm.wpos));
+    //paused, the callback won't skip the old PCM, it would hold the ring full for the new
+    pthread_mutex_lock(&ps->pauseLock);
+    if (atomic_load(&ps->paused)) ringSkip(&ps->pcm , ringFill(&ps->pcm));
+    pthread_mutex_unlock(&ps->pauseLock);
+    ps->audioSerial = serial;
+}
+
+//a file starts playing: restart the loudness measurement, with the file's cached value if it has one
+static void audioLoudnessStart(PlayerStatus* ps)
+{
+    double lufs = NAN;
+    if (!ps->opts.normalize) return;
+    if (loudnessCacheGet(ps->track.path , &lufs))
+        logger(LOG , "Loudness of %s: %.1f LUFS (cached), gain %.1f dB." , ps->track.path , lufs ,
+            av_clipd(ps->opts.loudnessTarget - lufs , -LOUDNESS_MAX_CUT , LOUDNESS_MAX_BOOST));
+    loudnessStart(&ps->loud , lufs);
+}
+
+//a file stops playing: cache its integrated loudness if enough of it was measured
+static void audioLoudnessSave(PlayerStatus* ps)
+{
+    double lufs;
+    if (!ps->opts.normalize || ps->loud.cached || loudnessMeasured(&ps->loud) < LOUDNESS_CACHE_MIN) return;
+    lufs = loudnessIntegrated(&ps->loud);
+    if (loudnessCachePut(ps->track.path , lufs))
+        logger(LOG , "Loudness of %s: %.1f LUFS over %.0f s, cached." , ps->track.path , lufs , loudnessMeasured(&ps->loud));
+}
+
+//the next playlist file starts: the last frames of this one are drained from the decoder,
+//then the next decoder takes over and its pts continue where this track's audio ended.
+//The device, the ring and the resampler carry on, so no gap or click is added
+static void audioNextTrack(PlayerStatus* ps , AVFrame* pf , int number)
+{
+    double end;
+    audioDecodePacket(ps , NULL , pf);
+    end = audioTrimmedEnd(ps);
+    audioLoudnessSave(ps);
+    avcodec_free_context(&ps->track.codecCtx);
+    ps->track = ps->nextTrack;
+    ps->track.base = end - (isnan(ps->track.start) ? 0 : ps->track.start);
+    ps->a_codecCtx = ps->track.codecCtx;
+    ps->audioNextPts = end;
+    ps->trimStart = isnan(ps->track.start) ? NAN : end;
+    ps->trimEnd = isnan(ps->track.end) ? NAN : ps->track.base + ps->track.end;
+    pthread_mutex_lock(&ps->trackLock);
+    atomic_store(&ps->trackPlaying , number);
+    pthread_cond_signal(&ps->trackCond);
+    pthread_mutex_unlock(&ps->trackLock);
+    logger(LOG , "Playing %s from %.3f s." , ps->track.path , end);
+    audioLoudnessStart(ps);
+}
+
+//a packet of a stream mixed into the playing one: decode it, convert it to the device
+//format and queue the PCM until the playing stream reaches its pts. A stream that runs
+//more than the fifo ahead loses its oldest PCM
+static void audioMixPacket(PlayerStatus* ps , MixTrack* m , AVPacket* pkt , AVFrame* pf)
+{
+    FFAudioParas* tgtParas = &ps->tgtParas;
+    int out_count , size , nb;
+    size_t len , space , drop;
+    if (avcodec_send_packet(m->track.codecCtx , pkt) < 0) return;
+    while (avcodec_receive_frame(m->track.codecCtx , pf) == 0)
     {
-        //send packet to codec
-        res = avcodec_send_packet(ctx , pkt);
-        if (res != 0)
+        if (!m->swrCtx)
         {
-            fprintf(stderr , "Failed to send packet to decoder.\n");
-            av_packet_unref(pkt);
-            res = -1;
-            return res;
+            m->swrCtx = swr_alloc_set_opts(NULL , tgtParas->channel_layout , tgtParas->fmt , tgtParas->freq ,
+                pf->channel_layout ? (int64_t)pf->channel_layout : av_get_default_channel_layout(pf->channels) ,
+                (enum AVSampleFormat)pf->format , pf->sample_rate , 0 , NULL);
+            if (m->swrCtx && swr_init(m->swrCtx) < 0) swr_free(&m->swrCtx);
+            if (!m->swrCtx) logger(LOG , "Cannot convert audio stream %d for mixing." , m->track.idx);
+        }
+        out_count = (int64_t)pf->nb_samples * tgtParas->freq / pf->sample_rate + 256;
+        size = av_samples_get_buffer_size(NULL , tgtParas->channels , out_count , tgtParas->fmt , 1);
+        if (size > 0 && (unsigned int)size > m->buf_len)
+        {
+            av_fast_malloc(&m->buf , &m->buf_len , size);
+        }
+        nb = m->swrCtx && m->buf && size > 0 ?
+            swr_convert(m->swrCtx , &m->buf , out_count , (const uint8_t**)pf->extended_data , pf->nb_samples) : 0;
+        //a frame without pts goes on where the queued PCM ended (pts stays there once it is
+        //all mixed), else where the playing stream is. PCM no pts can place is dropped
+        if (nb > 0 && ringFill(&m->fifo) == 0)
+        {
+            if (pf->best_effort_timestamp != AV_NOPTS_VALUE)
+                m->pts = m->track.base + pf->best_effort_timestamp * av_q2d(m->track.time_base);
+            else if (isnan(m->pts))
+                m->pts = !isnan(ps->audioNextPts) ? ps->audioNextPts : playerMasterClock(ps);
         }
-        //receive frame from codec
-        while (1)
+        if (nb > 0 && !isnan(m->pts))
         {
-            res = avcodec_receive_frame(ctx , pf);
-            printf("res:%d\n" , res);
-            if (res != 0)
+            len = (size_t)nb * tgtParas->frame_size;
+            space = ringSpace(&m->fifo);
+            if (len > space)
             {
-                if (res == AVERROR(EAGAIN))//pkt decoded
-                {
-                    resend = false;
-                    break;
-                }
-                else if (res == AVERROR_EOF)
-                {
-                    printf("the decoder has been fully flushed, and there will be no more output frames\n");
-                    return res;
-                }
-                else if (res == AVERROR(EINVAL))
-                {
-                    printf("codec not opened, or it is an encoder\n");
-                    return res;
-                }
-                else if (res == AVERROR_INPUT_CHANGED)
-                {
-                    printf("current decoded frame has changed parameters with respect to first decoded frame. Applicable when flag AV_CODEC_FLAG_DROPCHANGED is set\n");
-                    return res;
-                }
-                else
-                {
-                    printf("legitimate decoding errors\n");
-                    return res;
-                }
+                drop = ringSkip(&m->fifo , len - space);
+                m->pts += (double)(drop / tgtParas->frame_size) / tgtParas->freq;
             }
-            else//res==0
+            ringWrite(&m->fifo , m->buf , len);
+        }
+        av_frame_unref(pf);
+    }
+}
+
+//mix the queued PCM of every mixed stream into PCM of the playing stream that starts at
+//`start`, each at its gain, saturating. audioMixRelease() only calls it once the mixed
+//streams' PCM is queued or waited for long enough: a stream still short of it, because it
+//underruns or ended, is silence for the rest of the span
+//return the bytes of the mixed PCM, *buf then points at ps->mixBuf
+static int audioMix(PlayerStatus* ps , uint8_t** buf , int len , double start)
+{
+    FFAudioParas* tgtParas = &ps->tgtParas;
+    int frame_size = tgtParas->frame_size;
+    int frames = len / frame_size;
+    int fill , skip , offset , n;
+    if ((unsigned int)len > ps->mixBufLen)
+    {
+        av_fast_malloc(&ps->mixBuf , &ps->mixBufLen , len);
+        if (!ps->mixBuf) return len;
+    }
+    memset(ps->mixBuf , 0 , len);
+    if (!mixAdd(tgtParas->fmt , ps->mixBuf , *buf , frames * tgtParas->channels , ps->opts.mixGain[0])) return len;
+    for (int i = 0; i < ps->nbMix; i++)
+    {
+        MixTrack* m = &ps->mix[i];
+        fill = (int)(ringFill(&m->fifo) / frame_size);
+        offset = 0;
+        if (fill > 0 && m->pts < start)
+        {
+            //PCM from before this span, the stream was behind
+            skip = (int)FFMIN(lrint((start - m->pts) * tgtParas->freq) , fill);
+            ringSkip(&m->fifo , (size_t)skip * frame_size);
+            m->pts += (double)skip / tgtParas->freq;
+            fill -= skip;
+        }
+        else if (fill > 0)
+        {
+            //the stream starts later: silence up to there is its own, not an underrun
+            offset = (int)FFMIN(lrint((m->pts - start) * tgtParas->freq) , frames);
+        }
+        n = FFMIN(frames - offset , fill);
+        if (n > 0 && (unsigned int)(n * frame_size) > m->buf_len)
+        {
+            av_fast_malloc(&m->buf , &m->buf_len , (size_t)n * frame_size);
+        }
+        if (n > 0 && m->buf)
+        {
+            ringRead(&m->fifo , m->buf , (size_t)n * frame_size);
+            mixAdd(tgtParas->fmt , ps->mixBuf + (size_t)offset * frame_size , m->buf , n * tgtParas->channels , m->gain);
+            m->pts += (double)n / tgtParas->freq;
+        }
+        else n = 0;
+        //the fifo ran dry before the span's end
+        if (offset + n < frames && n == fill) m->underruns++;
+    }
+    *buf = ps->mixBuf;
+    return len;
+}
+
+//normalize, equalize and stretch PCM of the playing stream that ends at `end` into the ring.
+//`own` is false for the decoder's buffer, gains and filters then work on a copy
+static void audioPlayPcm(PlayerStatus* ps , uint8_t* buf , int len , bool own , double end)
+{
+    double rate;
+    float volume = playerVolumeGain(ps);
+    if (ps->opts.normalize || (ps->dspReady && dspActive(&ps->dsp , volume)))
+    {
+        //gains and filters work in place, never on the decoder's buffer
+        if (!own)
+        {
+            if ((unsigned int)len > ps->resample_buf_len)
             {
-                // s_audio_param_tgt是SDL可接受的音频帧数，是main()中取得的参数
-                // 在main()函数中又有“s_audio_param_src = s_audio_param_tgt”
-                // 此处表示：如果frame中的音频参数 == s_audio_param_src == s_audio_param_tgt，那音频重采样的过程就免了(因此时s_audio_swr_ctx是NULL)
-                // 否则使用frame(源)和s_audio_param_src(目标)中的音频参数来设置s_audio_swr_ctx，并使用frame中的音频参数来赋值s_audio_param_src
-                if (pf->format != srcParas.fmt ||
-                    (int64_t)pf->channel_layout != srcParas.channel_layout ||
-                    pf->sample_rate != srcParas.freq)
-                {
-                    swr_free(&swrCtx);
-                    swrCtx = swr_alloc_set_opts(NULL ,
-                        tgtParas.channel_layout ,
-                        tgtParas.fmt ,
-                        tgtParas.freq ,
-                        pf->channel_layout ,
-                        (enum AVSampleFormat)pf->format ,
-                        pf->sample_rate ,
-                        0 ,
-                        NULL);
-
-                    if (swrCtx == NULL || swr_init(swrCtx) < 0)
-                    {
-                        printf("Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n" ,
-                            pf->sample_rate , av_get_sample_fmt_name((enum AVSampleFormat)pf->format) , pf->channels ,
-                            tgtParas.freq , av_get_sample_fmt_name(tgtParas.fmt) , tgtParas.channels);
-                        swr_free(&swrCtx);
-                        return -1;
-                    }
-
-                    // 使用frame中的参数更新s_audio_param_src，第一次更新后后面基本不用执行此if分支了，因为一个音频流中各frame通用参数一样
-                    srcParas.channel_layout = pf->channel_layout;
-                    srcParas.channels = pf->channels;
-                    srcParas.freq = pf->sample_rate;
-                    srcParas.fmt = (enum AVSampleFormat)pf->format;
-                }
-
-                if (swrCtx != NULL)        // 重采样
-                {
-                    // 重采样输入参数1：输入音频样本数是p_frame->nb_samples
-                    // 重采样输入参数2：输入音频缓冲区
-                    const uint8_t** in = (const uint8_t**)pf->extended_data;
-                    // 重采样输出参数1：输出音频缓冲区尺寸
-                    // 重采样输出参数2：输出音频缓冲区
-                    uint8_t** out = &resample_buf;
-                    // 重采样输出参数：输出音频样本数(多加了256个样本)
-                    int out_count = (int64_t)pf->nb_samples * tgtParas.freq / pf->sample_rate + 256;
-                    // 重采样输出参数：输出音频缓冲区尺寸(以字节为单位)
-                    int out_size = av_samples_get_buffer_size(NULL , tgtParas.channels , out_count , tgtParas.fmt , 0);
-                    if (out_size < 0)
-                    {
-                        printf("av_samples_get_buffer_size() failed\n");
-                        return -1;
-                    }
-
-                    if (resample_buf == NULL)
-                    {
-                        av_fast_malloc(&resample_buf , &resample_buf_len , out_size);
-                    }
-                    if (resample_buf == NULL)
-                    {
-                        return AVERROR(ENOMEM);
-                    }
-                    // 音频重采样：返回值是重采样后得到的音频数据中单个声道的样本数
-                    nb_samples = swr_convert(swrCtx , out , out_count , in , pf->nb_samples);
-                    if (nb_samples < 0) {
-                        printf("swr_convert() failed\n");
-                        return -1;
-                    }
-                    if (nb_samples == out_count)
-                    {
-                        printf("audio buffer is probably too small\n");
-                        if (swr_init(swrCtx) < 0)
-                            swr_free(&swrCtx);
-                    }
-
-                    // 重采样返回的一帧音频数据大小(以字节为单位)
-                    p_cp_buf = resample_buf;
-                    cp_len = nb_samples * tgtParas.channels * av_get_bytes_per_sample(tgtParas.fmt);
-                }
-                else    // 不重采样
-                {
-                    // 根据相应音频参数，获得所需缓冲区大小
-                    frm_size = av_samples_get_buffer_size(
-                        NULL ,
-                        ctx->channels ,
-                        pf->nb_samples ,
-                        ctx->sample_fmt ,
-                        1);
-
-                    printf("frame size %d, buffer size %d\n" , frm_size , buf_size);
-                    assert(frm_size <= buf_size);
-
-                    p_cp_buf = pf->data[0];
-                    cp_len = frm_size;
-                }
-
-                // 将音频帧拷贝到函数输出参数audio_buf
-                memcpy(audio_buf , p_cp_buf , cp_len);
-                res = cp_len;
-                printf("cp_len:%d\n" , res);
-                return res;
+                av_fast_malloc(&ps->resample_buf , &ps->resample_buf_len , len);
+                if (!ps->resample_buf) logger(EXIT_FAILURE , "Failed to alloc resample buffer.");
             }
+            memcpy(ps->resample_buf , buf , len);
+            buf = ps->resample_buf;
+        }
+        if (ps->opts.normalize) loudnessProcess(&ps->loud , buf , len);
+        if (ps->dspReady) dspProcess(&ps->dsp , buf , len , volume);
+    }
+    //the stretcher holds some input back, the ring ends that far before `end`
+    rate = playerGetSpeed(ps);
+    stretchProcess(&ps->stretch , buf , len , rate , audioEmit , ps);
+    playerStampWrite(&ps->pcmMark , end - (double)stretchPending(&ps->stretch) / ps->tgtParas.freq ,
+        (double)atomic_load(&ps->pcm.wpos) , rate , ps->audioSerial);
+}
+
+//play the held PCM of the playing stream as far as every mixed stream's PCM covers it.
+//Demuxed by dts, a mixed stream's packet often arrives after the playing stream's packet
+//for the same time, so the playing stream waits for it, at most MIX_HOLD_SECONDS;
+//past that, or with `all` (end of stream, or no room left), the rest plays as it is
+static void audioMixRelease(PlayerStatus* ps , bool all)
+{
+    FFAudioParas* tgtParas = &ps->tgtParas;
+    int frame_size = tgtParas->frame_size;
+    int held = (int)(ringFill(&ps->mixHold) / frame_size);
+    int ready = held , len;
+    double covered;
+    uint8_t* buf;
+    if (held == 0) return;
+    for (int i = 0; i < ps->nbMix && !all; i++)
+    {
+        MixTrack* m = &ps->mix[i];
+        covered = ringFill(&m->fifo) > 0 ? m->pts + (double)(ringFill(&m->fifo) / frame_size) / tgtParas->freq : ps->mixHoldPts;
+        ready = FFMIN(ready , (int)FFMAX(lrint((covered - ps->mixHoldPts) * tgtParas->freq) , 0));
+    }
+    if (!all) ready = FFMAX(ready , held - (int)lrint(MIX_HOLD_SECONDS * tgtParas->freq));
+    if (ready <= 0) return;
+    len = ready * frame_size;
+    if ((unsigned int)len > ps->mixHoldBufLen)
+    {
+        av_fast_malloc(&ps->mixHoldBuf , &ps->mixHoldBufLen , len);
+        if (!ps->mixHoldBuf) logger(EXIT_FAILURE , "Failed to alloc mix buffer.");
+    }
+    ringRead(&ps->mixHold , ps->mixHoldBuf , len);
+    buf = ps->mixHoldBuf;
+    len = audioMix(ps , &buf , len , ps->mixHoldPts);
+    ps->mixHoldPts += (double)ready / tgtParas->freq;
+    audioPlayPcm(ps , buf , len , true , ps->mixHoldPts);
+}
+
+//hold PCM of the playing stream that starts at `start` until the mixed streams' PCM for it
+//is queued, see audioMixRelease()
+static void audioMixHold(PlayerStatus* ps , const uint8_t* buf , int len , double start)
+{
+    int frame_size = ps->tgtParas.frame_size;
+    size_t n;
+    if (ringFill(&ps->mixHold) == 0) ps->mixHoldPts = start;
+    while (len > 0)
+    {
+        //whole frames only, the ring's size isn't a multiple of them
+        n = ringWrite(&ps->mixHold , buf , FFMIN((size_t)len , ringSpace(&ps->mixHold) / frame_size * frame_size));
+        buf += n;
+        len -= (int)n;
+        if (len > 0) audioMixRelease(ps , true);
+    }
+    audioMixRelease(ps , false);
+}
+
+//convert a decoded frame of the playing track, trim it and write it to the PCM ring,
+//mixed with the other streams first if there are any
+static void audioPlayFrame(PlayerStatus* ps , AVFrame* pf)
+{
+    uint8_t* p_cp_buf = NULL;
+    int cp_len;
+    bool own;
+
+    //playlist time of the PCM, frames without a pts continue from the previous frame
+    if (pf->best_effort_timestamp != AV_NOPTS_VALUE)
+        ps->audioNextPts = ps->track.base + pf->best_effort_timestamp * av_q2d(ps->track.time_base);
+    ps->audioNextPts += (double)pf->nb_samples / pf->sample_rate;
+
+    cp_len = audioConvertFrame(ps , pf , &p_cp_buf);
+    //packed frames in the device format are played straight from the decoder's buffer
+    own = p_cp_buf != pf->data[0];
+    if (cp_len > 0) cp_len = audioTrim(ps , &p_cp_buf , cp_len);
+    if (cp_len <= 0) return;
+    if (ps->opts.mixTracks > 0)
+        audioMixHold(ps , p_cp_buf , cp_len , audioTrimmedEnd(ps) - (double)(cp_len / ps->tgtParas.frame_size) / ps->tgtParas.freq);
+    else audioPlayPcm(ps , p_cp_buf , cp_len , own , audioTrimmedEnd(ps));
+}
+
+//give up a pending audio stream switch
+static void audioSwitchCancel(PlayerStatus* ps)
+{
+    avcodec_free_context(&ps->switchTrack.codecCtx);
+    ps->switchWarmed = 0;
+    atomic_store(&ps->switchPending , false);
+}
+
+//a packet of the stream being switched to. Its first frame only warms the new decoder up,
+//later ones are dropped while they end before what the old stream already put in the ring.
+//The first frame past that is the pts boundary: it is trimmed to start exactly where the old
+//stream stops, the new decoder becomes the playing one and the old one is closed
+//return 1 if the switch happened on this packet, 0 otherwise
+static int audioSwitchPacket(PlayerStatus* ps , AVPacket* pkt , AVFrame* pf)
+{
+    Track* t = &ps->switchTrack;
+    double end;
+    if (avcodec_send_packet(t->codecCtx , pkt) < 0) return 0;
+    while (atomic_load(&ps->switchPending) && avcodec_receive_frame(t->codecCtx , pf) == 0)
+    {
+        end = pf->best_effort_timestamp != AV_NOPTS_VALUE ?
+            t->base + pf->best_effort_timestamp * av_q2d(t->time_base) + (double)pf->nb_samples / pf->sample_rate : NAN;
+        if (ps->switchWarmed++ == 0 || isnan(end) || end <= ps->audioNextPts)
+        {
+            av_frame_unref(pf);
+            continue;
+        }
+        avcodec_free_context(&ps->track.codecCtx);
+        ps->track = *t;
+        t->codecCtx = NULL;
+        pthread_mutex_lock(&ps->trackLock);
+        ps->a_idx = ps->track.idx;
+        pthread_mutex_unlock(&ps->trackLock);
+        ps->a_codecCtx = ps->track.codecCtx;
+        ps->trimStart = ps->audioNextPts;
+        ps->trimEnd = isnan(ps->track.end) ? NAN : ps->track.base + ps->track.end;
+        logger(LOG , "Audio stream %d plays from %.3f s: switched in %.1f ms, audible after %.1f ms more." ,
+            ps->track.idx , ps->audioNextPts , (playerGetTime() - ps->switchAt) * 1000 ,
+            ((double)ringFill(&ps->pcm) / ps->tgtParas.bytes_per_second + 2.0 * ps->adapt.samples / ps->tgtParas.freq +
+                ps->opts.audioLatency) * 1000);
+        audioPlayFrame(ps , pf);
+        av_frame_unref(pf);
+        ps->switchWarmed = 0;
+        atomic_store(&ps->switchPending , false);
+        //the rest of the packet is the playing stream's now, left in the decoder
+        //it would make the next send fail with EAGAIN and lose that packet
+        while (avcodec_receive_frame(ps->track.codecCtx , pf) == 0)
+        {
+            audioPlayFrame(ps , pf);
+            av_frame_unref(pf);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+//audio decode packet
+//decode every frame of the packet, convert it and write it to the PCM ring
+//0 on success, AVERROR_EOF once the decoder is fully flushed, other negative numbers on failure
+static int audioDecodePacket(PlayerStatus* ps , AVPacket* pkt , AVFrame* pf)
+{
+    AVCodecContext* ctx = ps->track.codecCtx;
+    int res;
 
+    //send packet to codec, the decoder's own buffers come from its pools and aren't ours to check
+    bool watch = rtcheckWatch(false);
+    res = avcodec_send_packet(ctx , pkt);
+    rtcheckWatch(watch);
+    if (res != 0 && res != AVERROR(EAGAIN))
+    {
+        if (res != AVERROR_EOF) logger(LOG , "Failed to send packet to decoder.");
+        return res;
+    }
+    //receive every frame from codec
+    while (1)
+    {
+        watch = rtcheckWatch(false);
+        res = avcodec_receive_frame(ctx , pf);
+        rtcheckWatch(watch);
+        if (res == AVERROR(EAGAIN))//pkt decoded
+        {
+            return 0;
+        }
+        else if (res == AVERROR_EOF)
+        {
+            logger(LOG , "the decoder has been fully flushed, and there will be no more output frames");
+            return res;
         }
+        else if (res == AVERROR(EINVAL))
+        {
+            logger(LOG , "codec not opened, or it is an encoder");
+            return res;
+        }
+        else if (res == AVERROR_INPUT_CHANGED)
+        {
+            logger(LOG , "current decoded frame has changed parameters with respect to first decoded frame. Applicable when flag AV_CODEC_FLAG_DROPCHANGED is set");
+            return res;
+        }
+        else if (res != 0)
+        {
+            logger(LOG , "legitimate decoding errors");
+            return res;
+        }
+
+        audioPlayFrame(ps , pf);
+        av_frame_unref(pf);
     }
-    return res;
+}
+
+//audio decode thread
+//1. dequeue packet from apq
+//2. decode and resample it
+//3. write S16 PCM into the ring the callback reads from
+//The frame is allocated once here, packet shells go back to the pool,
+//so once warmed up decoding a packet allocates nothing. Debug builds log it if it does (rtcheck),
+//builds with RTCHECK_ABORT abort. A start, seek, track change or stream switch warms up again:
+//a new format rebuilds the converters and may grow their buffers
+void* audioDecode(void* arg)
+{
+    PlayerStatus* ps = (PlayerStatus*)arg;
+    Queue* apq = &ps->apq;
+    AVPacket* pkt = NULL;
+    AVFrame* pf = av_frame_alloc();
+    int res;
+    double report = playerGetTime();
+    uint64_t packets = 0;//since the last warm up started
+#ifndef NDEBUG
+    uint64_t allocs = 0 , pool = 0;
+#endif
+    if (!pf) logger(EXIT_FAILURE , "Failed to allocate AVFrame.");
+    rtcheckWatch(true);
+
+    while (1)
+    {
+        playerWaitPaused(ps);
+        //get a packet, NULL flushes the decoder once the stream has all been read
+        if (!apq->dequeue(apq , (void**)&pkt))
+        {
+            if (!ps->isStreamFinished || !demuxDrain(ps)) continue;
+            pkt = NULL;
+        }
+        if (pkt && pkt->stream_index == PACKET_SEEK)
+        {
+            audioSeek(ps , pkt->pts / 1000000.0 , (int)pkt->pos);
+            packetPoolPut(&ps->pktPool , pkt);
+            packets = 0;
+            continue;
+        }
+        if (pkt && pkt->stream_index == PACKET_TRACK)
+        {
+            audioNextTrack(ps , pf , (int)pkt->pts);
+            packetPoolPut(&ps->pktPool , pkt);
+            packets = 0;
+            continue;
+        }
+        //other audio streams are mixed in or feed a switch to them, otherwise they aren't played
+        if (pkt && pkt->stream_index != ps->track.idx)
+        {
+            for (int i = 0; i < ps->nbMix; i++)
+            {
+                if (pkt->stream_index == ps->mix[i].track.idx) audioMixPacket(ps , &ps->mix[i] , pkt , pf);
+            }
+            if (atomic_load(&ps->switchPending) && pkt->stream_index == ps->switchTrack.idx && audioSwitchPacket(ps , pkt , pf))
+                packets = 0;
+            packetPoolPut(&ps->pktPool , pkt);
+            continue;
+        }
+#ifndef NDEBUG
+        allocs = rtcheckLocal(RTCHECK_ALLOC);
+#endif
+        res = audioDecodePacket(ps , pkt , pf);
+        if (pkt) packetPoolPut(&ps->pktPool , pkt);
+        packets++;
+#ifndef NDEBUG
+        //steady state check: after the warm up decoding a packet may not allocate.
+        //logged once, then the count warms up again
+        if (packets > AUDIO_WARMUP_PACKETS && res == 0 && rtcheckLocal(RTCHECK_ALLOC) != allocs)
+        {
+            logger(LOG , "Audio path allocated in steady state: %llu allocations decoding packet %llu since the warm up began." ,
+                (unsigned long long)(rtcheckLocal(RTCHECK_ALLOC) - allocs) , (unsigned long long)packets);
+#ifdef RTCHECK_ABORT
+            abort();
+#endif
+            packets = 0;
+        }
+        //shells only leave the pool for good when a packet leaks somewhere
+        if (packets == AUDIO_WARMUP_PACKETS) pool = atomic_load(&ps->pktPool.allocs);
+        else if (packets > AUDIO_WARMUP_PACKETS && atomic_load(&ps->pktPool.allocs) != pool)
+        {
+            logger(LOG , "Packet pool grew in steady state: %llu shells allocated after %llu packets." ,
+                (unsigned long long)(atomic_load(&ps->pktPool.allocs) - pool) , (unsigned long long)packets);
+            pool = atomic_load(&ps->pktPool.allocs);
+        }
+#endif
+        audioAdapt(ps);
+        //without video a seek made while paused is done once the target's PCM is in the ring
+        if (ps->v_idx == DEFAULT_VALUE && res == 0) playerSeekShown(ps , ps->audioSerial);
+        //without video the seek is done once the target is heard
+        if (ps->v_idx == DEFAULT_VALUE && atomic_load(&ps->seekReport) && !isnan(audioGetClock(ps)) &&
+            atomic_exchange(&ps->seekReport , false))
+            logger(LOG , "Seek took %.1f ms." , (playerGetTime() - ps->seekAt) * 1000);
+        if (playerGetTime() - report >= AUDIO_STATS_INTERVAL)
+        {
+            audioStatsReport(ps);
+            report = playerGetTime();
+        }
+        if (res == AVERROR_EOF)
+        {
+            if (atomic_load(&ps->switchPending)) audioSwitchCancel(ps);
+            audioLoudnessSave(ps);
+            //the mixed streams ended too, nothing more is coming for the held PCM
+            if (ps->opts.mixTracks > 0) audioMixRelease(ps , true);
+            stretchFlush(&ps->stretch , audioEmit , ps);
+            break;
+        }
+    }
+    ps->isAudioDecodeFinished = true;
+    logger(LOG , "All packets have been decoded.");
+    audioStatsReport(ps);
+    if (ps->v_idx == DEFAULT_VALUE) playerWake(ps , PLAYER_WAKE_END);
+    av_frame_free(&pf);
+    return NULL;
 }
 
 
@@ -213,81 +906,121 @@ int audioDecodePacket(AVCodecContext* ctx , AVPacket* pkt , uint8_t* audio_buf ,
 // Callback function's frequency of calling is usually between tens and hundreds of times per second, it depends on
 // SDL_AudioSpec's fields such as `freq`, `samples` and other factors such as hardware performance.
 //
+// This runs on SDL's real-time audio thread: no decoding, no locks, no allocation, no stdio.
+// It only copies from the PCM ring and pads an underrun with silence. Debug builds count
+// any call that breaks this (rtcheck), every build times each call against its buffer.
 void audioCallback(void* userdata , uint8_t* stream , int len)
 {
-    printf("len:%d\n" , len);
-    AVCodecContext* codecCtx = (AVCodecContext*)userdata;
-    if (!userdata) exitCase("Failed to get codec context.\n");
-
-    //add
-    Queue* apq = &player_status.apq;
-
-    int copyLen;
-    int getSize;
-    static uint8_t audio_buf[(MAX_AUDIO_FRAME_SIZE * 3 / 2)];//audio frame buffer, should be enough to stored every audio frame
-    static uint32_t received = 0;//how many bytes haved received from decoder, usually be the size of an audio frame
-    static uint32_t send = 0;//how many bytes have sent to SDL `stream`, SDL stream need `len` bytes every time when callback function is called
-    AVPacket* pkt = NULL;
+    PlayerStatus* ps = (PlayerStatus*)userdata;
+    AudioStats* st = &ps->astats;
+    double pts , pos , rate;
+    int serial;
+    double bps = ps->tgtParas.bytes_per_second;
+    double start = playerGetTime();
+    double share;
+    uint64_t ns;
+    int bucket = 0;
+    rtcheckEnter();
 
-    while (len > 0)
+    size_t flushed = atomic_load_explicit(&ps->pcmFlush , memory_order_acquire);
+    size_t played = atomic_load_explicit(&ps->pcm.rpos , memory_order_relaxed);
+    //a seek discarded what the ring held up to `flushed`
+    if (played < flushed) played += ringSkip(&ps->pcm , flushed - played);
+    size_t got = ringRead(&ps->pcm , stream , len);
+    if (got < (size_t)len)
     {
-        if (isAudioDecodeFinished) return;
-        if (send >= received)
-        {
-            //allocate a heap space to store packet
-            pkt = (AVPacket*)av_malloc(sizeof(AVPacket));
-            if (!pkt) exitCase("Failed to malloc packet.");
-
+        memset(stream + got , 0 , len - got);
+        atomic_fetch_add_explicit(&st->silences , 1 , memory_order_relaxed);
+        //waiting for the first PCM after start up or a seek is not an underrun
+        if (played > flushed && !ps->isAudioDecodeFinished) atomic_fetch_add_explicit(&st->underruns , 1 , memory_order_relaxed);
+    }
+    sem_post(&ps->pcmSpace);
 
-            //get a packet
-            if (!apq->dequeue(apq , (void**)&pkt))
-            {
-                //if stream has all been read, pkt=NULL
-                if (isStreamFinished)
-                {
-                    av_packet_unref(pkt);
-                    pkt = NULL;    // flush decoder
-                }
-                else
-                {
-                    av_packet_unref(pkt);
-                }
-            }
+    //audio clock: pts at the ring's read position, minus the bytes between it and
+    //the write mark still in the ring, minus SDL's buffers (the one playing and the
+    //`got` bytes just handed over) and the device latency past SDL.
+    //Output seconds are `rate` media seconds, the rate the PCM was stretched with
+    if (playerStampRead(&ps->pcmMark , &pts , &pos , &rate , &serial))
+    {
+        pts -= (pos - (double)atomic_load_explicit(&ps->pcm.rpos , memory_order_relaxed)) / bps * rate;
+        pts -= ((double)(len + got) / bps + ps->opts.audioLatency) * rate;
+        playerClockSet(ps , &ps->audioClock , pts , playerGetTime() , rate , serial);
+    }
 
-            //decode packet
-            getSize = audioDecodePacket(codecCtx , pkt , audio_buf , sizeof(audio_buf));
-            if (getSize > 0)
-            {
-                received = getSize;
-                send = 0;
-                av_packet_unref(pkt);
-            }
-            else if (getSize == 0 || getSize == AVERROR_EOF) //if getSize err, silence should be put into audio_buf
-            {
-                isAudioDecodeFinished = true;
-                printf("All packets have been decoded.\n");
+    //time spent against the time this buffer plays for
+    ns = (uint64_t)((playerGetTime() - start) * 1e9);
+    share = ns / (len / bps * 1e9) * 100;
+    while (bucket < AUDIO_STATS_BUCKETS - 1 && share >= audio_stats_bounds[bucket]) bucket++;
+    atomic_fetch_add_explicit(&st->hist[bucket] , 1 , memory_order_relaxed);
+    if (bucket == AUDIO_STATS_BUCKETS - 1) atomic_fetch_add_explicit(&st->overruns , 1 , memory_order_relaxed);
+    if (ns > atomic_load_explicit(&st->max_ns , memory_order_relaxed)) atomic_store_explicit(&st->max_ns , ns , memory_order_relaxed);
+    atomic_fetch_add_explicit(&st->calls , 1 , memory_order_relaxed);
+    rtcheckLeave();
+}
 
-            }
-            else
-            {
-                memset(audio_buf , 0 , 1024);
-                av_packet_unref(pkt);
-            }
-        }
-        copyLen = received - send;
-        if (copyLen > len)
-        {
-            copyLen = len;
-        }
+//log the callback's health: underruns, silence fills, the time per call histogram
+//and, in debug builds, calls the callback must never make
+void audioStatsReport(PlayerStatus* ps)
+{
+    AudioStats* st = &ps->astats;
+    char hist[256];
+    int n = 0;
+    for (int i = 0; i < AUDIO_STATS_BUCKETS && n < (int)sizeof(hist); i++)
+    {
+        if (i < AUDIO_STATS_BUCKETS - 1)
+            n += snprintf(hist + n , sizeof(hist) - n , " <%d%%:%llu" , audio_stats_bounds[i] , (unsigned long long)atomic_load(&st->hist[i]));
+        else
+            n += snprintf(hist + n , sizeof(hist) - n , " over:%llu" , (unsigned long long)atomic_load(&st->hist[i]));
+    }
+    logger(LOG , "Audio callback: %llu calls, %llu underruns, %llu silence fills, max %.3f ms of %.1f ms, time per call%s" ,
+        (unsigned long long)atomic_load(&st->calls) , (unsigned long long)atomic_load(&st->underruns) ,
+        (unsigned long long)atomic_load(&st->silences) , atomic_load(&st->max_ns) / 1e6 , st->budget * 1000 , hist);
+    logger(LOG , "Audio output latency: %.1f ms (device %d samples, ring %d buffers)." ,
+        audioOutputLatency(ps) * 1000 , ps->adapt.samples , ps->adapt.depth);
+    for (int i = 0; i < ps->nbMix; i++)
+        logger(LOG , "Mixed audio stream %d: %llu underruns." , ps->mix[i].track.idx , (unsigned long long)ps->mix[i].underruns);
+    if (ps->opts.normalize)
+        logger(LOG , "Loudness: momentary %.1f, short-term %.1f, integrated %.1f LUFS, gain %.1f dB." ,
+            loudnessMomentary(&ps->loud) , loudnessShortTerm(&ps->loud) , loudnessIntegrated(&ps->loud) , ps->loud.gain);
+#ifndef NDEBUG
+    if (rtcheckCount(RTCHECK_ALLOC) || rtcheckCount(RTCHECK_FREE) || rtcheckCount(RTCHECK_LOCK) || rtcheckCount(RTCHECK_STDIO))
+        logger(LOG , "Audio callback real-time violations: %llu allocations, %llu frees, %llu locks, %llu stdio calls." ,
+            (unsigned long long)rtcheckCount(RTCHECK_ALLOC) , (unsigned long long)rtcheckCount(RTCHECK_FREE) ,
+            (unsigned long long)rtcheckCount(RTCHECK_LOCK) ,
+            (unsigned long long)rtcheckCount(RTCHECK_STDIO));
+#endif
+}
+//the SDL format closest to a decoder sample format, planar formats map to their packed twin
+static SDL_AudioFormat audioSdlFormat(enum AVSampleFormat fmt)
+{
+    switch (av_get_packed_sample_fmt(fmt))
+    {
+    case AV_SAMPLE_FMT_FLT:
+    case AV_SAMPLE_FMT_DBL:
+        return AUDIO_F32SYS;
+    case AV_SAMPLE_FMT_S32:
+        return AUDIO_S32SYS;
+    default:
+        return AUDIO_S16SYS;
+    }
+}
 
-        // 将解码后的音频帧(s_audio_buf+)写入音频设备缓冲区(stream)，播放
-        memcpy(stream , (uint8_t*)audio_buf + send , copyLen);
-        len -= copyLen;
-        stream += copyLen;
-        send += copyLen;
+//the packed sample format SDL plays, AV_SAMPLE_FMT_NONE if there is none
+static enum AVSampleFormat audioAvFormat(SDL_AudioFormat fmt)
+{
+    switch (fmt)
+    {
+    case AUDIO_F32SYS:
+        return AV_SAMPLE_FMT_FLT;
+    case AUDIO_S32SYS:
+        return AV_SAMPLE_FMT_S32;
+    case AUDIO_S16SYS:
+        return AV_SAMPLE_FMT_S16;
+    default:
+        return AV_SAMPLE_FMT_NONE;
     }
-    av_free(pkt);
 }
+
 int openAudio(PlayerStatus* ps)
 {
     AVCodecContext* codecCtx = ps->a_codecCtx;
@@ -297,24 +1030,106 @@ int openAudio(PlayerStatus* ps)
 
     //audio
     // desiredSpec.size is autoly caculated by size=samples * channels * (bytes per sample)
+    // ask for exactly what the decoder outputs, so the common formats need no resampler
     desiredSpec.freq = codecCtx->sample_rate;
-    desiredSpec.format = AUDIO_S16SYS;//unsigned 16-bit samples in native byte order
+    desiredSpec.format = audioSdlFormat(codecCtx->sample_fmt);
     desiredSpec.channels = codecCtx->channels;
     desiredSpec.silence = 0;
-    desiredSpec.samples = AUDIO_BUFFER_SIZE;//must be power of 2
+    desiredSpec.samples = AUDIO_BUFFER_MIN;//must be power of 2, audioAdapt() grows it
     desiredSpec.callback = audioCallback;
-    desiredSpec.userdata = codecCtx;
+    desiredSpec.userdata = ps;
 
+    // with `obtainedSpec` SDL may change any field to what the device really takes
     if (SDL_OpenAudio(&desiredSpec , &obtainedSpec)) logger(EXIT_FAILURE , "Failed to open audio device.\n");
+    if (audioAvFormat(obtainedSpec.format) == AV_SAMPLE_FMT_NONE)
+    {
+        // a device format we can't produce: let SDL convert from S16
+        SDL_CloseAudio();
+        desiredSpec.format = AUDIO_S16SYS;//signed 16-bit samples in native byte order
+        if (SDL_OpenAudio(&desiredSpec , NULL)) logger(EXIT_FAILURE , "Failed to open audio device.\n");
+        obtainedSpec = desiredSpec;
+    }
+    logger(LOG , "Audio device: %d Hz, %d channels, %s (decoder %d Hz, %d channels, %s)" ,
+        obtainedSpec.freq , obtainedSpec.channels , av_get_sample_fmt_name(audioAvFormat(obtainedSpec.format)) ,
+        codecCtx->sample_rate , codecCtx->channels , av_get_sample_fmt_name(codecCtx->sample_fmt));
     //Build audio resampling parameters based on SDL audio parameters.
-    tgtParas.fmt = AV_SAMPLE_FMT_S16;
-    tgtParas.freq = obtainedSpec.freq;
-    tgtParas.channel_layout = av_get_default_channel_layout(obtainedSpec.channels);;
-    tgtParas.channels = obtainedSpec.channels;
-    tgtParas.frame_size = av_samples_get_buffer_size(NULL , obtainedSpec.channels , 1 , tgtParas.fmt , 1);
-    tgtParas.bytes_per_second = av_samples_get_buffer_size(NULL , obtainedSpec.channels , obtainedSpec.freq , tgtParas.fmt , 1);
-    if (tgtParas.bytes_per_second <= 0 || tgtParas.frame_size <= 0) logger(EXIT_FAILURE , "Failed to get buffer size.\n");
-    srcParas = tgtParas;
+    FFAudioParas* tgtParas = &ps->tgtParas;
+    tgtParas->fmt = audioAvFormat(obtainedSpec.format);
+    tgtParas->freq = obtainedSpec.freq;
+    tgtParas->channel_layout = av_get_default_channel_layout(obtainedSpec.channels);;
+    tgtParas->channels = obtainedSpec.channels;
+    tgtParas->frame_size = av_samples_get_buffer_size(NULL , obtainedSpec.channels , 1 , tgtParas->fmt , 1);
+    tgtParas->bytes_per_second = av_samples_get_buffer_size(NULL , obtainedSpec.channels , obtainedSpec.freq , tgtParas->fmt , 1);
+    if (tgtParas->bytes_per_second <= 0 || tgtParas->frame_size <= 0) logger(EXIT_FAILURE , "Failed to get buffer size.\n");
+    ps->srcParas = *tgtParas;
+    ps->conv.in_channels = 0;//nothing set up yet
+    ps->audioNextPts = 0;
+    memset(&ps->astats , 0 , sizeof(ps->astats));
+    ps->astats.budget = (double)obtainedSpec.samples / obtainedSpec.freq;
+    ps->adapt.samples = obtainedSpec.samples;
+    ps->adapt.depth = AUDIO_RING_MIN;
+    ps->adapt.limit = (size_t)ps->adapt.depth * ps->adapt.samples * tgtParas->frame_size;
+    ps->adapt.underruns = 0;
+    ps->adapt.since = ps->adapt.checked = playerGetTime();
+    ps->adapt.stable = AUDIO_STABLE_MIN;
+    ps->adapt.shrunk = false;
+    ps->adapt.paused = 0;
+    logger(LOG , "Audio output latency: %.1f ms (device %d samples, ring %d buffers)." ,
+        audioOutputLatency(ps) * 1000 , ps->adapt.samples , ps->adapt.depth);
+    memset(&ps->drift , 0 , sizeof(ps->drift));
+    ps->drift.coef = exp(log(0.01) / AUDIO_DRIFT_AVG_NB);
+    atomic_init(&ps->pcmMark.seq , 0);
+    atomic_init(&ps->audioClock.stamp.seq , 0);
+    atomic_init(&ps->audioClock.drift , 0.0);
+    convertInit();
+    biquadInit();
+    if (!stretchInit(&ps->stretch , ps->tgtParas.fmt , ps->tgtParas.channels , ps->tgtParas.freq))
+        logger(LOG , "No time stretch for %s, audio plays at normal speed." , av_get_sample_fmt_name(ps->tgtParas.fmt));
+
+    //allocated for the largest sizes, adapt.limit is how much of it is used
+    if (!ringInit(&ps->pcm , (size_t)AUDIO_RING_MAX * FFMAX(AUDIO_BUFFER_MAX , obtainedSpec.samples) * tgtParas->frame_size))
+        logger(EXIT_FAILURE , "Failed to alloc PCM ring.");
+    if (sem_init(&ps->pcmSpace , 0 , 0)) logger(EXIT_FAILURE , "Failed to init PCM semaphore.");
+    //mixed streams queue up to MIX_FIFO_SECONDS of converted PCM each
+    if (ps->opts.mixTracks > 0 || ps->opts.normalize) mixInit();
+    for (int i = 0; i < ps->nbMix; i++)
+    {
+        if (!ringInit(&ps->mix[i].fifo , (size_t)(MIX_FIFO_SECONDS * tgtParas->bytes_per_second)))
+            logger(EXIT_FAILURE , "Failed to alloc mix fifo.");
+    }
+    //the playing stream waits up to MIX_HOLD_SECONDS for them, plus the frame being held
+    if (ps->opts.mixTracks > 0 && !ringInit(&ps->mixHold , (size_t)(MIX_HOLD_SECONDS * tgtParas->bytes_per_second) + MAX_AUDIO_FRAME_SIZE))
+        logger(EXIT_FAILURE , "Failed to alloc mix hold ring.");
+    //the normalizer scales with the mixer's kernels
+    if (ps->opts.normalize && !loudnessInit(&ps->loud , tgtParas->fmt , tgtParas->channels , tgtParas->channel_layout ,
+        tgtParas->freq , ps->opts.loudnessTarget))
+    {
+        logger(LOG , "No loudness normalization for %d channels of %s." , tgtParas->channels , av_get_sample_fmt_name(tgtParas->fmt));
+        ps->opts.normalize = false;
+    }
+    audioLoudnessStart(ps);
+    ps->dspReady = dspInit(&ps->dsp , tgtParas->fmt , tgtParas->channels , tgtParas->freq , ps->opts.eq , ps->opts.eqBands);
+    if (!ps->dspReady)
+        logger(LOG , "No volume control or equalizer for %d channels of %s." , tgtParas->channels , av_get_sample_fmt_name(tgtParas->fmt));
+    //one resample buffer for the whole stream
+    av_fast_malloc(&ps->resample_buf , &ps->resample_buf_len , MAX_AUDIO_FRAME_SIZE);
+    if (!ps->resample_buf) logger(EXIT_FAILURE , "Failed to alloc resample buffer.");
+
+    //the analyzer's history outlives the ring, so the audible window is still there
+    if (ps->opts.visualize && !spectrumInit(&ps->spectrum , ps->tgtParas.fmt , ps->tgtParas.channels , ps->tgtParas.freq ,
+        ps->pcm.size * 2 + (size_t)SPECTRUM_FFT_SIZE * ps->tgtParas.channels * av_get_bytes_per_sample(ps->tgtParas.fmt) * 2))
+    {
+        logger(LOG , "No spectrum analyzer for %s." , av_get_sample_fmt_name(ps->tgtParas.fmt));
+        ps->opts.visualize = false;
+    }
+
+    pthread_t audioDecodeThread;
+    pthread_create(&audioDecodeThread , NULL , audioDecode , ps);
+    if (ps->opts.visualize)
+    {
+        pthread_t audioAnalyzeThread;
+        pthread_create(&audioAnalyzeThread , NULL , audioAnalyze , ps);
+    }
 
     SDL_PauseAudio(0);
     return 1;
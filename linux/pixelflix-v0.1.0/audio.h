@@ -5,5 +5,7 @@
 #include <libavutil/samplefmt.h>
 
 int openAudio(PlayerStatus* ps);
+double audioGetClock(PlayerStatus* ps);
+void audioStatsReport(PlayerStatus* ps);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "biquad.h"
+#include "convert.h"
+#include "logger.h"
+#include <string.h>
+#include <math.h>
+#include <libavutil/cpu.h>
+#include <libavutil/common.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+//kernels, one set per instruction set, picked at runtime by biquadInit().
+//They work on a chunk of frames, one channel per lane
+
+typedef struct BiquadKernels
+{
+    const char* name;
+    //one biquad (transposed direct form II) over the chunk in place, c is b0 b1 b2 a1 a2, z the state
+    void (*biquad)(float (*x)[BIQUAD_LANES] , int n , int lanes , const float* c , float* z);
+    //add the squared samples to sum, per lane
+    void (*power)(const float (*x)[BIQUAD_LANES] , int n , int lanes , float* sum);
+    //scale frame i by g + i * step
+    void (*ramp)(float (*x)[BIQUAD_LANES] , int n , int lanes , float g , float step);
+}BiquadKernels;
+
+static void biquadC(float (*x)[BIQUAD_LANES] , int n , int lanes , const float* c , float* z)
+{
+    for (int l = 0; l < lanes; l++)
+    {
+        float z0 = z[l] , z1 = z[BIQUAD_LANES + l] , v , y;
+        for (int i = 0; i < n; i++)
+        {
+            v = x[i][l];
+            y = c[0] * v + z0;
+            z0 = c[1] * v - c[3] * y + z1;
+            z1 = c[2] * v - c[4] * y;
+            x[i][l] = y;
+        }
+        z[l] = z0;
+        z[BIQUAD_LANES + l] = z1;
+    }
+}
+
+static void powerC(const float (*x)[BIQUAD_LANES] , int n , int lanes , float* sum)
+{
+    for (int l = 0; l < lanes; l++)
+    {
+        float s = 0;
+        for (int i = 0; i < n; i++) s += x[i][l] * x[i][l];
+        sum[l] += s;
+    }
+}
+
+static void rampC(float (*x)[BIQUAD_LANES] , int n , int lanes , float g , float step)
+{
+    for (int i = 0; i < n; i++)
+    {
+        for (int l = 0; l < lanes; l++) x[i][l] *= g;
+        g += step;
+    }
+}
+
+static const BiquadKernels kernelsC = { "c" , biquadC , powerC , rampC };
+
+#if defined(__x86_64__)
+static void biquadSSE2(float (*x)[BIQUAD_LANES] , int n , int lanes , const float* c , float* z)
+{
+    const __m128 b0 = _mm_set1_ps(c[0]) , b1 = _mm_set1_ps(c[1]) , b2 = _mm_set1_ps(c[2]);
+    const __m128 a1 = _mm_set1_ps(c[3]) , a2 = _mm_set1_ps(c[4]);
+    for (int g = 0; g < lanes; g += 4)
+    {
+        __m128 z0 = _mm_loadu_ps(z + g) , z1 = _mm_loadu_ps(z + BIQUAD_LANES + g) , v , y;
+        for (int i = 0; i < n; i++)
+        {
+            v = _mm_loadu_ps(x[i] + g);
+            y = _mm_add_ps(_mm_mul_ps(b0 , v) , z0);
+            z0 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1 , v) , _mm_mul_ps(a1 , y)) , z1);
+            z1 = _mm_sub_ps(_mm_mul_ps(b2 , v) , _mm_mul_ps(a2 , y));
+            _mm_storeu_ps(x[i] + g , y);
+        }
+        _mm_storeu_ps(z + g , z0);
+        _mm_storeu_ps(z + BIQUAD_LANES + g , z1);
+    }
+}
+
+static void powerSSE2(const float (*x)[BIQUAD_LANES] , int n , int lanes , float* sum)
+{
+    for (int g = 0; g < lanes; g += 4)
+    {
+        __m128 s = _mm_setzero_ps() , v;
+        for (int i = 0; i < n; i++)
+        {
+            v = _mm_loadu_ps(x[i] + g);
+            s = _mm_add_ps(s , _mm_mul_ps(v , v));
+        }
+        _mm_storeu_ps(sum + g , _mm_add_ps(_mm_loadu_ps(sum + g) , s));
+    }
+}
+
+static void rampSSE2(float (*x)[BIQUAD_LANES] , int n , int lanes , float g , float step)
+{
+    __m128 vg;
+    for (int i = 0; i < n; i++)
+    {
+        vg = _mm_set1_ps(g + i * step);
+        for (int l = 0; l < lanes; l += 4) _mm_storeu_ps(x[i] + l , _mm_mul_ps(_mm_loadu_ps(x[i] + l) , vg));
+    }
+}
+
+static const BiquadKernels kernelsSSE2 = { "sse2" , biquadSSE2 , powerSSE2 , rampSSE2 };
+
+__attribute__((target("avx2")))
+static void biquadAVX2(float (*x)[BIQUAD_LANES] , int n , int lanes , const float* c , float* z)
+{
+    const __m256 b0 = _mm256_set1_ps(c[0]) , b1 = _mm256_set1_ps(c[1]) , b2 = _mm256_set1_ps(c[2]);
+    const __m256 a1 = _mm256_set1_ps(c[3]) , a2 = _mm256_set1_ps(c[4]);
+    __m256 z0 = _mm256_loadu_ps(z) , z1 = _mm256_loadu_ps(z + BIQUAD_LANES) , v , y;
+    (void)lanes;//all 8 lanes in one vector, the unused ones carry zeros
+    for (int i = 0; i < n; i++)
+    {
+        v = _mm256_loadu_ps(x[i]);
+        y = _mm256_add_ps(_mm256_mul_ps(b0 , v) , z0);
+        z0 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1 , v) , _mm256_mul_ps(a1 , y)) , z1);
+        z1 = _mm256_sub_ps(_mm256_mul_ps(b2 , v) , _mm256_mul_ps(a2 , y));
+        _mm256_storeu_ps(x[i] , y);
+    }
+    _mm256_storeu_ps(z , z0);
+    _mm256_storeu_ps(z + BIQUAD_LANES , z1);
+}
+
+__attribute__((target("avx2")))
+static void powerAVX2(const float (*x)[BIQUAD_LANES] , int n , int lanes , float* sum)
+{
+    __m256 s = _mm256_setzero_ps() , v;
+    (void)lanes;
+    for (int i = 0; i < n; i++)
+    {
+        v = _mm256_loadu_ps(x[i]);
+        s = _mm256_add_ps(s , _mm256_mul_ps(v , v));
+    }
+    _mm256_storeu_ps(sum , _mm256_add_ps(_mm256_loadu_ps(sum) , s));
+}
+
+__attribute__((target("avx2")))
+static void rampAVX2(float (*x)[BIQUAD_LANES] , int n , int lanes , float g , float step)
+{
+    (void)lanes;
+    for (int i = 0; i < n; i++) _mm256_storeu_ps(x[i] , _mm256_mul_ps(_mm256_loadu_ps(x[i]) , _mm256_set1_ps(g + i * step)));
+}
+
+static const BiquadKernels kernelsAVX2 = { "avx2" , biquadAVX2 , powerAVX2 , rampAVX2 };
+#endif
+
+#if defined(__aarch64__)
+static void biquadNEON(float (*x)[BIQUAD_LANES] , int n , int lanes , const float* c , float* z)
+{
+    for (int g = 0; g < lanes; g += 4)
+    {
+        float32x4_t z0 = vld1q_f32(z + g) , z1 = vld1q_f32(z + BIQUAD_LANES + g) , v , y;
+        for (int i = 0; i < n; i++)
+        {
+            v = vld1q_f32(x[i] + g);
+            y = vmlaq_n_f32(z0 , v , c[0]);
+            z0 = vmlsq_n_f32(vmlaq_n_f32(z1 , v , c[1]) , y , c[3]);
+            z1 = vmlsq_n_f32(vmulq_n_f32(v , c[2]) , y , c[4]);
+            vst1q_f32(x[i] + g , y);
+        }
+        vst1q_f32(z + g , z0);
+        vst1q_f32(z + BIQUAD_LANES + g , z1);
+    }
+}
+
+static void powerNEON(const float (*x)[BIQUAD_LANES] , int n , int lanes , float* sum)
+{
+    for (int g = 0; g < lanes; g += 4)
+    {
+        float32x4_t s = vdupq_n_f32(0) , v;
+        for (int i = 0; i < n; i++)
+        {
+            v = vld1q_f32(x[i] + g);
+            s = vmlaq_f32(s , v , v);
+        }
+        vst1q_f32(sum + g , vaddq_f32(vld1q_f32(sum + g) , s));
+    }
+}
+
+static void rampNEON(float (*x)[BIQUAD_LANES] , int n , int lanes , float g , float step)
+{
+    for (int i = 0; i < n; i++)
+    {
+        for (int l = 0; l < lanes; l += 4) vst1q_f32(x[i] + l , vmulq_n_f32(vld1q_f32(x[i] + l) , g + i * step));
+    }
+}
+
+static const BiquadKernels kernelsNEON = { "neon" , biquadNEON , powerNEON , rampNEON };
+#endif
+
+static const BiquadKernels* kernels = &kernelsC;
+
+//the wide path: S32 filtered in double. S32 devices are rare, it stays in C
+static void biquadDouble(double (*x)[BIQUAD_LANES] , int n , int lanes , const double* c , double* z)
+{
+    for (int l = 0; l < lanes; l++)
+    {
+        double z0 = z[l] , z1 = z[BIQUAD_LANES + l] , v , y;
+        for (int i = 0; i < n; i++)
+        {
+            v = x[i][l];
+            y = c[0] * v + z0;
+            z0 = c[1] * v - c[3] * y + z1;
+            z1 = c[2] * v - c[4] * y;
+            x[i][l] = y;
+        }
+        z[l] = z0;
+        z[BIQUAD_LANES + l] = z1;
+    }
+}
+
+//pick the widest kernel set the cpu runs
+int biquadInit(void)
+{
+    int flags = av_get_cpu_flags();
+    kernels = &kernelsC;
+#if defined(__x86_64__)
+    if (flags & AV_CPU_FLAG_AVX2) kernels = &kernelsAVX2;
+    else if (flags & AV_CPU_FLAG_SSE2) kernels = &kernelsSSE2;
+#elif defined(__aarch64__)
+    if (flags & AV_CPU_FLAG_NEON) kernels = &kernelsNEON;
+#else
+    (void)flags;
+#endif
+    logger(LOG , "Biquad kernels: %s" , kernels->name);
+    return 1;
+}
+
+//---------------------------------------------------------------------------
+
+//set up a chunk for packed PCM, `precise` keeps S32 in double for a stage that writes it back
+//return 1 on success, 0 if the format or channel count isn't supported
+int biquadChunkInit(BiquadChunk* ch , enum AVSampleFormat fmt , int channels , bool precise)
+{
+    memset(ch , 0 , sizeof(*ch));
+    ch->fmt = av_get_packed_sample_fmt(fmt);
+    if (ch->fmt != AV_SAMPLE_FMT_S16 && ch->fmt != AV_SAMPLE_FMT_S32 && ch->fmt != AV_SAMPLE_FMT_FLT) return 0;
+    if (channels < 1 || channels > BIQUAD_LANES) return 0;
+    ch->channels = channels;
+    ch->lanes = (channels + 3) & ~3;
+    ch->wide = precise && ch->fmt == AV_SAMPLE_FMT_S32;
+    return 1;
+}
+
+//load n frames of packed PCM into the chunk, through the conversion kernels
+void biquadLoad(BiquadChunk* ch , const uint8_t* buf , int n)
+{
+    int m = n * ch->channels;
+    const float* s = (const float*)buf;
+    if (ch->wide)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < ch->channels; c++) ch->xd[i][c] = ((const int32_t*)buf)[i * ch->channels + c] * (1.0 / 2147483648.0);
+        }
+        return;
+    }
+    //8 channels are frame-major without padding already, they convert straight into x
+    if (ch->channels == BIQUAD_LANES)
+    {
+        convertToFloat(&ch->x[0][0] , buf , ch->fmt , m);
+        return;
+    }
+    if (ch->fmt != AV_SAMPLE_FMT_FLT)
+    {
+        convertToFloat(ch->tmp , buf , ch->fmt , m);
+        s = ch->tmp;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        for (int c = 0; c < ch->channels; c++) ch->x[i][c] = s[i * ch->channels + c];
+    }
+}
+
+//write the first n frames of the chunk back as packed PCM, saturating
+void biquadStore(BiquadChunk* ch , uint8_t* buf , int n)
+{
+    int m = n * ch->channels;
+    if (ch->wide)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < ch->channels; c++)
+                ((int32_t*)buf)[i * ch->channels + c] = (int32_t)lrint(av_clipd(ch->xd[i][c] * 2147483648.0 , -2147483648.0 , 2147483647.0));
+        }
+        return;
+    }
+    if (ch->channels == BIQUAD_LANES)
+    {
+        convertFromFloat(buf , &ch->x[0][0] , ch->fmt , m);
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        for (int c = 0; c < ch->channels; c++) ch->tmp[i * ch->channels + c] = ch->x[i][c];
+    }
+    convertFromFloat(buf , ch->tmp , ch->fmt , m);
+}
+
+//run one biquad over the first n frames of the chunk
+//c is b0 b1 b2 a1 a2, z the section's state as z[2][BIQUAD_LANES], double for the wide path
+void biquadRun(BiquadChunk* ch , int n , const double* c , double* z)
+{
+    float cf[5] , zf[2 * BIQUAD_LANES];
+    if (ch->wide)
+    {
+        biquadDouble(ch->xd , n , ch->lanes , c , z);
+        for (int i = 0; i < 2 * BIQUAD_LANES; i++) z[i] = fabs(z[i]) < 1e-30 ? 0 : z[i];
+        return;
+    }
+    for (int i = 0; i < 5; i++) cf[i] = (float)c[i];
+    for (int i = 0; i < 2 * BIQUAD_LANES; i++) zf[i] = (float)z[i];
+    kernels->biquad(ch->x , n , ch->lanes , cf , zf);
+    //long silences would leave the state decaying into denormals, which are slow
+    for (int i = 0; i < 2 * BIQUAD_LANES; i++) z[i] = fabsf(zf[i]) < 1e-15f ? 0 : zf[i];
+}
+
+//scale frames first to first + n - 1, frame i by g + i * step
+void biquadRamp(BiquadChunk* ch , int first , int n , float g , float step)
+{
+    if (!ch->wide)
+    {
+        kernels->ramp(ch->x + first , n , ch->lanes , g , step);
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        for (int c = 0; c < ch->channels; c++) ch->xd[first + i][c] *= (double)g + (double)i * step;
+    }
+}
+
+//add the squares of the first n frames to sum, per channel. Float only, a meter needs no wide path
+void biquadPower(const BiquadChunk* ch , int n , float* sum)
+{
+    kernels->power((const float (*)[BIQUAD_LANES])ch->x , n , ch->lanes , sum);
+}
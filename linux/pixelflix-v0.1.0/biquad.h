@@ -0,0 +1,33 @@
+#ifndef BIQUAD_H__
+#define BIQUAD_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavutil/samplefmt.h>
+
+//biquad filters for the audio decode thread, shared by the loudness meter and the equalizer:
+//packed PCM is loaded a chunk of frames at a time, one channel per SIMD lane, and filtered in place
+
+#define BIQUAD_LANES 8 //channels at most
+#define BIQUAD_CHUNK 256 //frames in one pass
+
+//a chunk of frames, frame-major, the lanes past the channels stay zero
+typedef struct BiquadChunk
+{
+    enum AVSampleFormat fmt;//packed S16, S32 or FLT
+    int channels;
+    int lanes;//channels rounded up for the kernels
+    bool wide;//S32 kept in double in xd, float would drop its low 8 bits
+    float x[BIQUAD_CHUNK][BIQUAD_LANES];
+    double xd[BIQUAD_CHUNK][BIQUAD_LANES];
+    float tmp[BIQUAD_CHUNK * BIQUAD_LANES];//packed samples converted to float
+}BiquadChunk;
+
+int biquadInit(void);
+int biquadChunkInit(BiquadChunk* ch , enum AVSampleFormat fmt , int channels , bool precise);
+void biquadLoad(BiquadChunk* ch , const uint8_t* buf , int n);
+void biquadStore(BiquadChunk* ch , uint8_t* buf , int n);
+void biquadRun(BiquadChunk* ch , int n , const double* c , double* z);
+void biquadRamp(BiquadChunk* ch , int first , int n , float g , float step);
+void biquadPower(const BiquadChunk* ch , int n , float* sum);
+
+#endif
@@ -0,0 +1,585 @@
+#include "convert.h"
+#include "logger.h"
+#include <string.h>
+#include <math.h>
+#include <libavutil/cpu.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/common.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//planar stereo -> interleaved, 32 bit samples (float or int, only bits are moved)
+static int interleave2x32(uint32_t* dst , const uint32_t* l , const uint32_t* r , int nb_samples)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= nb_samples; i += 4)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i) , _mm_unpacklo_epi32(a , b));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 4) , _mm_unpackhi_epi32(a , b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= nb_samples; i += 4)
+    {
+        uint32x4x2_t v = { { vld1q_u32(l + i) , vld1q_u32(r + i) } };
+        vst2q_u32(dst + 2 * i , v);
+    }
+#endif
+    for (; i < nb_samples; i++)
+    {
+        dst[2 * i] = l[i];
+        dst[2 * i + 1] = r[i];
+    }
+    return nb_samples;
+}
+
+//planar stereo -> interleaved, 16 bit samples
+static int interleave2x16(uint16_t* dst , const uint16_t* l , const uint16_t* r , int nb_samples)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= nb_samples; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(l + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(r + i));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i) , _mm_unpacklo_epi16(a , b));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i + 8) , _mm_unpackhi_epi16(a , b));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= nb_samples; i += 8)
+    {
+        uint16x8x2_t v = { { vld1q_u16(l + i) , vld1q_u16(r + i) } };
+        vst2q_u16(dst + 2 * i , v);
+    }
+#endif
+    for (; i < nb_samples; i++)
+    {
+        dst[2 * i] = l[i];
+        dst[2 * i + 1] = r[i];
+    }
+    return nb_samples;
+}
+
+//planar -> interleaved without changing the sample format, e.g. FLTP -> FLT.
+//This is all the conversion left when SDL accepted the decoder's rate, channels and sample type.
+//return the bytes written to dst
+int convertInterleave(uint8_t* dst , const uint8_t* const* src , int nb_samples , int channels , int bytes_per_sample)
+{
+    if (channels == 1)
+    {
+        memcpy(dst , src[0] , (size_t)nb_samples * bytes_per_sample);
+    }
+    else if (channels == 2 && bytes_per_sample == 4)
+    {
+        interleave2x32((uint32_t*)dst , (const uint32_t*)src[0] , (const uint32_t*)src[1] , nb_samples);
+    }
+    else if (channels == 2 && bytes_per_sample == 2)
+    {
+        interleave2x16((uint16_t*)dst , (const uint16_t*)src[0] , (const uint16_t*)src[1] , nb_samples);
+    }
+    else if (bytes_per_sample == 4)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            const uint32_t* s = (const uint32_t*)src[c];
+            uint32_t* d = (uint32_t*)dst + c;
+            for (int i = 0; i < nb_samples; i++) d[i * channels] = s[i];
+        }
+    }
+    else if (bytes_per_sample == 2)
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            const uint16_t* s = (const uint16_t*)src[c];
+            uint16_t* d = (uint16_t*)dst + c;
+            for (int i = 0; i < nb_samples; i++) d[i * channels] = s[i];
+        }
+    }
+    else
+    {
+        for (int c = 0; c < channels; c++)
+        {
+            for (int i = 0; i < nb_samples; i++)
+                memcpy(dst + ((size_t)i * channels + c) * bytes_per_sample , src[c] + (size_t)i * bytes_per_sample , bytes_per_sample);
+        }
+    }
+    return nb_samples * channels * bytes_per_sample;
+}
+
+//---------------------------------------------------------------------------
+//kernels, one set per instruction set, picked at runtime by convertInit()
+
+typedef struct ConvertKernels
+{
+    const char* name;
+    void (*s16ToFloat)(float* dst , const int16_t* src , int n);
+    void (*s32ToFloat)(float* dst , const int32_t* src , int n);
+    void (*axpy)(float* dst , const float* src , float g , int n);//dst += g * src
+    void (*packS16)(int16_t* dst , const float* const* src , int channels , int n);//interleave, round, saturate
+    void (*floatToS16)(int16_t* dst , const float* src , int n);//round, saturate
+}ConvertKernels;
+
+static void s16ToFloatC(float* dst , const int16_t* src , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = src[i] * (1.0f / 32768.0f);
+}
+
+static void s32ToFloatC(float* dst , const int32_t* src , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = src[i] * (1.0f / 2147483648.0f);
+}
+
+static void axpyC(float* dst , const float* src , float g , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] += g * src[i];
+}
+
+static void packS16C(int16_t* dst , const float* const* src , int channels , int n)
+{
+    for (int c = 0; c < channels; c++)
+    {
+        const float* s = src[c];
+        for (int i = 0; i < n; i++)
+        {
+            long v = lrintf(s[i] * 32768.0f);
+            dst[i * channels + c] = v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+        }
+    }
+}
+
+static void floatToS16C(int16_t* dst , const float* src , int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        long v = lrintf(src[i] * 32768.0f);
+        dst[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+    }
+}
+
+static const ConvertKernels kernelsC = { "c" , s16ToFloatC , s32ToFloatC , axpyC , packS16C , floatToS16C };
+
+#if defined(__x86_64__)
+static void s16ToFloatSSE2(float* dst , const int16_t* src , int n)
+{
+    const __m128 k = _mm_set1_ps(1.0f / 32768.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x , x) , 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x , x) , 16);
+        _mm_storeu_ps(dst + i , _mm_mul_ps(_mm_cvtepi32_ps(lo) , k));
+        _mm_storeu_ps(dst + i + 4 , _mm_mul_ps(_mm_cvtepi32_ps(hi) , k));
+    }
+    s16ToFloatC(dst + i , src + i , n - i);
+}
+
+static void s32ToFloatSSE2(float* dst , const int32_t* src , int n)
+{
+    const __m128 k = _mm_set1_ps(1.0f / 2147483648.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dst + i , _mm_mul_ps(_mm_cvtepi32_ps(x) , k));
+    }
+    s32ToFloatC(dst + i , src + i , n - i);
+}
+
+static void axpySSE2(float* dst , const float* src , float g , int n)
+{
+    const __m128 vg = _mm_set1_ps(g);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm_storeu_ps(dst + i , _mm_add_ps(_mm_loadu_ps(dst + i) , _mm_mul_ps(_mm_loadu_ps(src + i) , vg)));
+    }
+    axpyC(dst + i , src + i , g , n - i);
+}
+
+static void packS16SSE2(int16_t* dst , const float* const* src , int channels , int n)
+{
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    const float* l = src[0];
+    const float* r = src[channels - 1];
+    int i = 0;
+    if (channels != 2)
+    {
+        packS16C(dst , src , channels , n);
+        return;
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        //clamp before converting, cvtps gives INT_MIN for out of range values of either sign
+        __m128i li = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(l + i) , scale) , lo) , hi));
+        __m128i ri = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(r + i) , scale) , lo) , hi));
+        __m128i v = _mm_packs_epi32(_mm_unpacklo_epi32(li , ri) , _mm_unpackhi_epi32(li , ri));
+        _mm_storeu_si128((__m128i*)(dst + 2 * i) , v);
+    }
+    const float* rest[2] = { l + i , r + i };
+    packS16C(dst + 2 * i , rest , 2 , n - i);
+}
+
+static void floatToS16SSE2(int16_t* dst , const float* src , int n)
+{
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i) , scale) , lo) , hi));
+        __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i + 4) , scale) , lo) , hi));
+        _mm_storeu_si128((__m128i*)(dst + i) , _mm_packs_epi32(a , b));
+    }
+    floatToS16C(dst + i , src + i , n - i);
+}
+
+static const ConvertKernels kernelsSSE2 = { "sse2" , s16ToFloatSSE2 , s32ToFloatSSE2 , axpySSE2 , packS16SSE2 , floatToS16SSE2 };
+
+__attribute__((target("avx2")))
+static void s16ToFloatAVX2(float* dst , const int16_t* src , int n)
+{
+    const __m256 k = _mm256_set1_ps(1.0f / 32768.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_ps(dst + i , _mm256_mul_ps(_mm256_cvtepi32_ps(x) , k));
+    }
+    s16ToFloatC(dst + i , src + i , n - i);
+}
+
+__attribute__((target("avx2")))
+static void s32ToFloatAVX2(float* dst , const int32_t* src , int n)
+{
+    const __m256 k = _mm256_set1_ps(1.0f / 2147483648.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_ps(dst + i , _mm256_mul_ps(_mm256_cvtepi32_ps(x) , k));
+    }
+    s32ToFloatC(dst + i , src + i , n - i);
+}
+
+__attribute__((target("avx2")))
+static void axpyAVX2(float* dst , const float* src , float g , int n)
+{
+    const __m256 vg = _mm256_set1_ps(g);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(dst + i , _mm256_add_ps(_mm256_loadu_ps(dst + i) , _mm256_mul_ps(_mm256_loadu_ps(src + i) , vg)));
+    }
+    axpyC(dst + i , src + i , g , n - i);
+}
+
+__attribute__((target("avx2")))
+static void packS16AVX2(int16_t* dst , const float* const* src , int channels , int n)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    const float* l = src[0];
+    const float* r = src[channels - 1];
+    int i = 0;
+    if (channels != 2)
+    {
+        packS16C(dst , src , channels , n);
+        return;
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i li = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(l + i) , scale) , lo) , hi));
+        __m256i ri = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(r + i) , scale) , lo) , hi));
+        //unpack and pack both work per 128 bit lane, so the lanes come out in order
+        __m256i v = _mm256_packs_epi32(_mm256_unpacklo_epi32(li , ri) , _mm256_unpackhi_epi32(li , ri));
+        _mm256_storeu_si256((__m256i*)(dst + 2 * i) , v);
+    }
+    const float* rest[2] = { l + i , r + i };
+    packS16C(dst + 2 * i , rest , 2 , n - i);
+}
+
+__attribute__((target("avx2")))
+static void floatToS16AVX2(int16_t* dst , const float* src , int n)
+{
+    const __m256 scale = _mm256_set1_ps(32768.0f);
+    const __m256 lo = _mm256_set1_ps(-32768.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i v = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i) , scale) , lo) , hi));
+        _mm_storeu_si128((__m128i*)(dst + i) , _mm_packs_epi32(_mm256_castsi256_si128(v) , _mm256_extracti128_si256(v , 1)));
+    }
+    floatToS16C(dst + i , src + i , n - i);
+}
+
+static const ConvertKernels kernelsAVX2 = { "avx2" , s16ToFloatAVX2 , s32ToFloatAVX2 , axpyAVX2 , packS16AVX2 , floatToS16AVX2 };
+#endif
+
+#if defined(__aarch64__)
+static void s16ToFloatNEON(float* dst , const int16_t* src , int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x8_t x = vld1q_s16(src + i);
+        vst1q_f32(dst + i , vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))) , 1.0f / 32768.0f));
+        vst1q_f32(dst + i + 4 , vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))) , 1.0f / 32768.0f));
+    }
+    s16ToFloatC(dst + i , src + i , n - i);
+}
+
+static void s32ToFloatNEON(float* dst , const int32_t* src , int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        vst1q_f32(dst + i , vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(src + i)) , 1.0f / 2147483648.0f));
+    }
+    s32ToFloatC(dst + i , src + i , n - i);
+}
+
+static void axpyNEON(float* dst , const float* src , float g , int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        vst1q_f32(dst + i , vmlaq_n_f32(vld1q_f32(dst + i) , vld1q_f32(src + i) , g));
+    }
+    axpyC(dst + i , src + i , g , n - i);
+}
+
+static void packS16NEON(int16_t* dst , const float* const* src , int channels , int n)
+{
+    const float* l = src[0];
+    const float* r = src[channels - 1];
+    int i = 0;
+    if (channels != 2)
+    {
+        packS16C(dst , src , channels , n);
+        return;
+    }
+    for (; i + 4 <= n; i += 4)
+    {
+        //vcvtn rounds to nearest and saturates, vqmovn saturates to 16 bit
+        int16x4x2_t v;
+        v.val[0] = vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(l + i) , 32768.0f)));
+        v.val[1] = vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(r + i) , 32768.0f)));
+        vst2_s16(dst + 2 * i , v);
+    }
+    const float* rest[2] = { l + i , r + i };
+    packS16C(dst + 2 * i , rest , 2 , n - i);
+}
+
+static void floatToS16NEON(int16_t* dst , const float* src , int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        vst1_s16(dst + i , vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(src + i) , 32768.0f))));
+    }
+    floatToS16C(dst + i , src + i , n - i);
+}
+
+static const ConvertKernels kernelsNEON = { "neon" , s16ToFloatNEON , s32ToFloatNEON , axpyNEON , packS16NEON , floatToS16NEON };
+#endif
+
+static const ConvertKernels* kernels = &kernelsC;
+
+//pick the widest kernel set the cpu runs
+int convertInit(void)
+{
+    int flags = av_get_cpu_flags();
+    kernels = &kernelsC;
+#if defined(__x86_64__)
+    if (flags & AV_CPU_FLAG_AVX2) kernels = &kernelsAVX2;
+    else if (flags & AV_CPU_FLAG_SSE2) kernels = &kernelsSSE2;
+#elif defined(__aarch64__)
+    if (flags & AV_CPU_FLAG_NEON) kernels = &kernelsNEON;
+#else
+    (void)flags;
+#endif
+    logger(LOG , "Audio conversion kernels: %s" , kernels->name);
+    return 1;
+}
+
+//n samples of packed S16, S32 or FLT to float, for the stages that filter in float
+void convertToFloat(float* dst , const uint8_t* src , enum AVSampleFormat fmt , int n)
+{
+    if (fmt == AV_SAMPLE_FMT_S16) kernels->s16ToFloat(dst , (const int16_t*)src , n);
+    else if (fmt == AV_SAMPLE_FMT_S32) kernels->s32ToFloat(dst , (const int32_t*)src , n);
+    else memcpy(dst , src , sizeof(float) * n);
+}
+
+//n floats back to packed S16, S32 or FLT, saturating
+void convertFromFloat(uint8_t* dst , const float* src , enum AVSampleFormat fmt , int n)
+{
+    if (fmt == AV_SAMPLE_FMT_S16)
+    {
+        kernels->floatToS16((int16_t*)dst , src , n);
+    }
+    else if (fmt == AV_SAMPLE_FMT_S32)
+    {
+        for (int i = 0; i < n; i++) ((int32_t*)dst)[i] = (int32_t)lrint(av_clipd((double)src[i] * 2147483648.0 , -2147483648.0 , 2147483647.0));
+    }
+    else
+    {
+        for (int i = 0; i < n; i++) ((float*)dst)[i] = av_clipf(src[i] , -1 , 1);
+    }
+}
+
+//---------------------------------------------------------------------------
+
+//gains of one input channel into left and right, ITU style: centre and
+//surrounds at -3 dB, LFE dropped
+static void convertChannelGains(uint64_t ch , float* l , float* r)
+{
+    const float m3db = 0.70710678f;
+    *l = 0;
+    *r = 0;
+    if (ch == AV_CH_FRONT_LEFT) *l = 1;
+    else if (ch == AV_CH_FRONT_RIGHT) *r = 1;
+    else if (ch == AV_CH_FRONT_CENTER) *l = *r = m3db;
+    else if (ch == AV_CH_BACK_LEFT || ch == AV_CH_SIDE_LEFT) *l = m3db;
+    else if (ch == AV_CH_BACK_RIGHT || ch == AV_CH_SIDE_RIGHT) *r = m3db;
+    else if (ch != AV_CH_LOW_FREQUENCY) *l = *r = m3db * m3db;//anything else, e.g. back centre
+}
+
+//prepare cv for frames of the given input, a no-op if nothing changed.
+//1 if the kernels handle it, 0 if swresample is needed
+int convertSetup(Converter* cv , enum AVSampleFormat in_fmt , int64_t in_layout , int in_channels ,
+    enum AVSampleFormat out_fmt , int out_channels , bool dither)
+{
+    if (cv->in_fmt == in_fmt && cv->in_layout == in_layout && cv->in_channels == in_channels &&
+        cv->out_fmt == out_fmt && cv->out_channels == out_channels && cv->dither == dither)
+    {
+        return cv->supported;
+    }
+    cv->in_fmt = in_fmt;
+    cv->in_layout = in_layout;
+    cv->in_channels = in_channels;
+    cv->out_fmt = out_fmt;
+    cv->out_channels = out_channels;
+    cv->dither = dither;
+    cv->seed = 0x12345678u;
+    cv->downmix = in_channels != out_channels;
+    cv->supported =
+        (in_fmt == AV_SAMPLE_FMT_FLTP || in_fmt == AV_SAMPLE_FMT_S32P || in_fmt == AV_SAMPLE_FMT_S16P) &&
+        (out_fmt == AV_SAMPLE_FMT_S16 || out_fmt == AV_SAMPLE_FMT_FLT) &&
+        in_channels <= CONVERT_MAX_CHANNELS &&
+        (!cv->downmix || (out_channels == 2 && in_channels > 2 &&
+            av_get_channel_layout_nb_channels(in_layout) == in_channels));
+    if (!cv->supported || !cv->downmix) return cv->supported;
+
+    //downmix matrix from the layout, normalized so a full scale input can't clip
+    float sum_l = 0 , sum_r = 0 , norm;
+    int c = 0;
+    for (int bit = 0; bit < 64 && c < in_channels; bit++)
+    {
+        if (!(in_layout & (1ULL << bit))) continue;
+        convertChannelGains(1ULL << bit , &cv->matrix[0][c] , &cv->matrix[1][c]);
+        sum_l += cv->matrix[0][c];
+        sum_r += cv->matrix[1][c];
+        c++;
+    }
+    norm = sum_l > sum_r ? sum_l : sum_r;
+    if (norm <= 0) norm = 1;
+    for (c = 0; c < in_channels; c++)
+    {
+        cv->matrix[0][c] /= norm;
+        cv->matrix[1][c] /= norm;
+    }
+    return 1;
+}
+
+//TPDF dither: add the difference of two uniform randoms, +-1 LSB of S16
+static void convertDither(Converter* cv , float* dst , const float* src , int n)
+{
+    const float k = 1.0f / 32768.0f / 4294967296.0f;
+    uint32_t s = cv->seed;
+    uint32_t r1 , r2;
+    for (int i = 0; i < n; i++)
+    {
+        s = s * 1664525u + 1013904223u;
+        r1 = s;
+        s = s * 1664525u + 1013904223u;
+        r2 = s;
+        dst[i] = src[i] + ((float)r1 - (float)r2) * k;
+    }
+    cv->seed = s;
+}
+
+//convert nb_samples planar input samples as set up by convertSetup()
+//return the bytes written to dst
+int convertRun(Converter* cv , uint8_t* dst , const uint8_t* const* src , int nb_samples)
+{
+    const int out_bps = av_get_bytes_per_sample(cv->out_fmt);
+    const float* ch[CONVERT_MAX_CHANNELS];
+    const float* out[CONVERT_MAX_CHANNELS];
+    int out_channels = cv->downmix ? 2 : cv->in_channels;
+    int m;
+
+    for (int off = 0; off < nb_samples; off += m)
+    {
+        m = nb_samples - off < CONVERT_BLOCK ? nb_samples - off : CONVERT_BLOCK;
+        //1. to float
+        for (int c = 0; c < cv->in_channels; c++)
+        {
+            if (cv->in_fmt == AV_SAMPLE_FMT_FLTP)
+            {
+                ch[c] = (const float*)src[c] + off;
+                continue;
+            }
+            if (cv->in_fmt == AV_SAMPLE_FMT_S16P) kernels->s16ToFloat(cv->tmp[c] , (const int16_t*)src[c] + off , m);
+            else kernels->s32ToFloat(cv->tmp[c] , (const int32_t*)src[c] + off , m);
+            ch[c] = cv->tmp[c];
+        }
+        //2. downmix
+        for (int o = 0; o < out_channels; o++)
+        {
+            if (!cv->downmix)
+            {
+                out[o] = ch[o];
+                continue;
+            }
+            memset(cv->mix[o] , 0 , sizeof(float) * m);
+            for (int c = 0; c < cv->in_channels; c++)
+            {
+                if (cv->matrix[o][c] != 0) kernels->axpy(cv->mix[o] , ch[c] , cv->matrix[o][c] , m);
+            }
+            out[o] = cv->mix[o];
+        }
+        //3. pack
+        if (cv->out_fmt == AV_SAMPLE_FMT_S16)
+        {
+            //S16P -> S16 without a downmix is exact, nothing to dither
+            if (cv->dither && (cv->in_fmt != AV_SAMPLE_FMT_S16P || cv->downmix))
+            {
+                for (int o = 0; o < out_channels; o++)
+                {
+                    convertDither(cv , cv->mix[o] , out[o] , m);
+                    out[o] = cv->mix[o];
+                }
+            }
+            kernels->packS16((int16_t*)dst + (size_t)off * out_channels , out , out_channels , m);
+        }
+        else
+        {
+            convertInterleave(dst + (size_t)off * out_channels * out_bps , (const uint8_t* const*)out , m , out_channels , out_bps);
+        }
+    }
+    return nb_samples * out_channels * out_bps;
+}
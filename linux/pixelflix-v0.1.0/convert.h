@@ -0,0 +1,39 @@
+#ifndef CONVERT_H__
+#define CONVERT_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavutil/samplefmt.h>
+
+//sample conversion kernels for the audio decode thread
+
+#define CONVERT_MAX_CHANNELS 8
+#define CONVERT_BLOCK 256 //samples per channel converted in one pass
+
+//fixed-rate conversion of planar decoder output to what SDL plays:
+//FLTP/S32P/S16P -> interleaved S16/FLT, optionally downmixed to stereo.
+//Only a real sample rate change still needs swresample.
+typedef struct Converter
+{
+    enum AVSampleFormat in_fmt;
+    enum AVSampleFormat out_fmt;
+    int64_t in_layout;
+    int in_channels;
+    int out_channels;
+    bool supported;//the kernels can do this conversion
+    bool downmix;
+    bool dither;//TPDF dither when reducing to S16
+    uint32_t seed;
+    float matrix[2][CONVERT_MAX_CHANNELS];//downmix gains, [out][in]
+    float tmp[CONVERT_MAX_CHANNELS][CONVERT_BLOCK];//input converted to float
+    float mix[CONVERT_MAX_CHANNELS][CONVERT_BLOCK];//downmixed / dithered
+}Converter;
+
+int convertInit(void);
+int convertInterleave(uint8_t* dst , const uint8_t* const* src , int nb_samples , int channels , int bytes_per_sample);
+int convertSetup(Converter* cv , enum AVSampleFormat in_fmt , int64_t in_layout , int in_channels ,
+    enum AVSampleFormat out_fmt , int out_channels , bool dither);
+int convertRun(Converter* cv , uint8_t* dst , const uint8_t* const* src , int nb_samples);
+void convertToFloat(float* dst , const uint8_t* src , enum AVSampleFormat fmt , int n);
+void convertFromFloat(uint8_t* dst , const float* src , enum AVSampleFormat fmt , int n);
+
+#endif
@@ -1,45 +1,191 @@
 #include "demux.h"
 #include "logger.h"
 #include "player.h"
+#include <math.h>
 #include <libavformat/avformat.h>
 #include <pthread.h>
 
+//queue a control packet for a decode thread
+static void demuxMark(PlayerStatus* ps , Queue* q , int kind , int64_t pts , int serial)
+{
+    AVPacket* mark = packetPoolGet(&ps->pktPool);
+    mark->stream_index = kind;
+    mark->pts = pts;
+    mark->pos = serial;
+    q->enqueue(q , mark);
+}
+
+//hand a packet to the decode thread of its stream
+static void demuxRoute(PlayerStatus* ps , AVPacket* p_packet)
+{
+    if (p_packet->stream_index == ps->v_idx)//video packet
+    {
+        logger(LOG , "vpq enqueue.");
+        ps->vpq.enqueue(&ps->vpq , p_packet);
+    }
+    else if (ps->fmtCtx->streams[p_packet->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)//audio packet, of any stream that wasn't discarded
+    {
+        logger(LOG , "apq enqueue.");
+        ps->apq.enqueue(&ps->apq , p_packet);
+    }
+    else
+    {
+        printf("Not video or audio packet.\n");
+        packetPoolPut(&ps->pktPool , p_packet);
+    }
+}
+
+//a fast seek lands wherever the nearest keyframe is: read on to the first video packet
+//and take its pts as the target, the packets read meanwhile are passed on afterwards
+//return the number of packets held
+static int demuxPeekKeyframe(PlayerStatus* ps , AVPacket** held , double* target)
+{
+    AVStream* st = ps->fmtCtx->streams[ps->v_idx];
+    int n = 0;
+    while (n < DEMUX_SEEK_PEEK)
+    {
+        held[n] = packetPoolGet(&ps->pktPool);
+        if (av_read_frame(ps->fmtCtx , held[n]) < 0)
+        {
+            packetPoolPut(&ps->pktPool , held[n]);
+            break;
+        }
+        if (held[n++]->stream_index != ps->v_idx) continue;
+        if (held[n - 1]->pts != AV_NOPTS_VALUE) *target = held[n - 1]->pts * av_q2d(st->time_base);
+        else if (held[n - 1]->dts != AV_NOPTS_VALUE) *target = held[n - 1]->dts * av_q2d(st->time_base);
+        break;
+    }
+    return n;
+}
+
+//seek the playing file and start a new timeline. The file is seeked on the video stream if
+//there is one, so it lands on a video keyframe: the nearest one for a fast seek, the one at
+//or before the target for an accurate seek. Both packet queues are flushed and the clocks
+//reset before each decode thread gets a marker with the target and the new serial; the
+//decoders drop what precedes the target, audio to the sample, video to the frame
+static void demuxDoSeek(PlayerStatus* ps , int reading)
+{
+    Track* t = &ps->track;
+    double target = ps->seekTarget;
+    int flags = ps->seekFlags;
+    AVPacket* held[DEMUX_SEEK_PEEK];
+    AVRational tb;
+    int64_t ts;
+    int idx , serial , n = 0;
+    //the next file is already queued behind this one, the seek would land in the wrong file
+    if (reading != atomic_load(&ps->trackPlaying))
+    {
+        logger(LOG , "Seek ignored: the next track is already queued.");
+        playerSeekStarted(ps , 0);
+        return;
+    }
+    if (!isnan(t->start)) target = FFMAX(target , t->base + t->start);
+    idx = ps->v_idx != DEFAULT_VALUE ? ps->v_idx : t->idx;
+    tb = ps->fmtCtx->streams[idx]->time_base;
+    ts = (int64_t)((target - t->base) / av_q2d(tb));
+    if (avformat_seek_file(ps->fmtCtx , idx , INT64_MIN , ts , flags == PLAYER_SEEK_ACCURATE ? ts : INT64_MAX , 0) < 0)
+    {
+        logger(LOG , "Failed to seek to %.3f s." , target);
+        playerSeekStarted(ps , 0);
+        return;
+    }
+    ps->apq.flush(&ps->apq , &ps->pktPool);
+    ps->vpq.flush(&ps->vpq , &ps->pktPool);
+    serial = playerResetClocks(ps);
+    playerSeekStarted(ps , serial);
+    if (flags == PLAYER_SEEK_FAST && ps->v_idx != DEFAULT_VALUE) n = demuxPeekKeyframe(ps , held , &target);
+    atomic_store(&ps->seekReport , true);
+    if (ps->a_idx != DEFAULT_VALUE) demuxMark(ps , &ps->apq , PACKET_SEEK , llrint(target * 1000000) , serial);
+    if (ps->v_idx != DEFAULT_VALUE) demuxMark(ps , &ps->vpq , PACKET_SEEK , llrint(target * 1000000) , serial);
+    for (int i = 0; i < n; i++) demuxRoute(ps , held[i]);
+    logger(LOG , "Seek to %.3f s (%s)." , target , flags == PLAYER_SEEK_ACCURATE ? "accurate" : "fast");
+}
+
+//gapless playlist: open the next file once this one is fully read, so its first packets
+//queue up behind the last ones of this file while those still play.
+//At most one file is read ahead, this file is closed, it can no longer be seeked in.
+//The new file replaces fmtCtx under trackLock, the other threads only read it under it
+//return 1 if there is a next file to read, 0 at the end of the playlist
+static int demuxNextTrack(PlayerStatus* ps , int* reading)
+{
+    int next = *reading + 1;
+    //the audio decode thread still has to take over the file read before this one
+    pthread_mutex_lock(&ps->trackLock);
+    while (atomic_load(&ps->trackPlaying) < *reading) pthread_cond_wait(&ps->trackCond , &ps->trackLock);
+    pthread_mutex_unlock(&ps->trackLock);
+    while (next <= ps->opts.playlistLen && !playerOpenTrack(&ps->nextTrack , ps->opts.playlist[next - 1])) next++;
+    if (next > ps->opts.playlistLen) return 0;
+    pthread_mutex_lock(&ps->trackLock);
+    avformat_close_input(&ps->fmtCtx);
+    ps->fmtCtx = ps->nextTrack.fmtCtx;
+    ps->a_idx = ps->nextTrack.idx;
+    pthread_mutex_unlock(&ps->trackLock);
+    *reading = next;
+    demuxMark(ps , &ps->apq , PACKET_TRACK , next , atomic_load(&ps->serial));
+    logger(LOG , "Queued %s." , ps->nextTrack.path);
+    return 1;
+}
+
+//request a seek to `pts` of playlist time, the demux thread carries it out.
+//A stream read to the end is read again from the target, until a decoder drained it
+//return 1 if the request was queued, 0 if it was ignored
+int demuxSeek(PlayerStatus* ps , double pts)
+{
+    if (isnan(pts))
+    {
+        logger(LOG , "Seek ignored: no position to seek from.");
+        return 0;
+    }
+    pthread_mutex_lock(&ps->demuxLock);
+    if (ps->streamDrained)
+    {
+        pthread_mutex_unlock(&ps->demuxLock);
+        logger(LOG , "Seek ignored: playback has reached the end.");
+        return 0;
+    }
+    ps->seekTarget = FFMAX(pts , 0);
+    atomic_store(&ps->seekPending , true);
+    //the decoders wait for the seek's packets instead of draining
+    ps->isStreamFinished = false;
+    pthread_cond_signal(&ps->demuxCond);
+    pthread_mutex_unlock(&ps->demuxLock);
+    return 1;
+}
+
+//a decoder found its queue empty at the end of the stream. Unless a seek came first,
+//it drains its decoder for good from here on, and the stream can't be seeked any more
+//return 1 if it drains, 0 if a seek is reading the stream again
+int demuxDrain(PlayerStatus* ps)
+{
+    int drain;
+    pthread_mutex_lock(&ps->demuxLock);
+    if (ps->isStreamFinished) ps->streamDrained = true;
+    drain = ps->streamDrained;
+    pthread_mutex_unlock(&ps->demuxLock);
+    return drain;
+}
+
 //thread dePacket
 void* demux(void* arg)
 {
     printf("thread start\n");
     PlayerStatus* ps = (PlayerStatus*)arg;
-    AVFormatContext* p_avfmt_ctx = ps->fmtCtx;
-    int v_idx = ps->v_idx;
-    int a_idx = ps->a_idx;
     Queue* vpq = &ps->vpq;
     Queue* apq = &ps->apq;
 
     int ret;
+    int reading = 0;//playlist position being read, one ahead of the playing one near a track's end
     AVPacket* p_packet;
     while (1)
     {
-        p_packet = av_packet_alloc();
-        if (!p_packet) logger(EXIT_FAILURE , "Failed to alloc packet.");
+        playerWaitPaused(ps);
+        if (atomic_exchange(&ps->seekPending , false)) demuxDoSeek(ps , reading);
+        p_packet = packetPoolGet(&ps->pktPool);
 
-        ret = av_read_frame(p_avfmt_ctx , p_packet);
+        ret = av_read_frame(ps->fmtCtx , p_packet);
         if (ret == 0) //Ok
         {
-            if (p_packet->stream_index == v_idx)//video packet
-            {
-                logger(LOG , "vpq enqueue.");
-                vpq->enqueue(vpq , p_packet);
-            }
-            else if (p_packet->stream_index == a_idx)//audio packet
-            {
-                logger(LOG , "apq enqueue.");
-
-                apq->enqueue(apq , p_packet);
-            }
-            else
-            {
-                printf("Not video or audio packet.\n");
-            }
+            demuxRoute(ps , p_packet);
             //You can't release the packet because once you release the packet,
             // the space which `data` pointer in packet point to will be freed,
             // when you dequeue the packet from the queue, it will try to access unknown space.
@@ -51,10 +197,20 @@ void* demux(void* arg)
         }
         else
         {
-            ps->isStreamFinished = true;
-            printf("All packets have been enqueued.\n");
-            // av_packet_unref(p_packet);
-            break;
+            packetPoolPut(&ps->pktPool , p_packet);
+            if (demuxNextTrack(ps , &reading)) continue;
+            //the queues still hold seconds of playback: the file stays open and a seek
+            //until the decoders drained them reads it again
+            pthread_mutex_lock(&ps->demuxLock);
+            if (!atomic_load(&ps->seekPending))
+            {
+                ps->isStreamFinished = true;
+                vpq->wakeup(vpq);
+                apq->wakeup(apq);
+                printf("All packets have been enqueued.\n");
+                while (ps->isStreamFinished) pthread_cond_wait(&ps->demuxCond , &ps->demuxLock);
+            }
+            pthread_mutex_unlock(&ps->demuxLock);
         }
 
 
@@ -1,8 +1,13 @@
 #ifndef DEMUX_H__
 #define DEMUX_H__
 #include "player.h"
+
+#define DEMUX_SEEK_PEEK 64 //packets a fast seek reads ahead looking for the video keyframe it landed on
+
 void* demux(void* arg);
 
 int openDemux(PlayerStatus* ps);
+int demuxSeek(PlayerStatus* ps , double pts);
+int demuxDrain(PlayerStatus* ps);
 
 #endif
\ No newline at end of file
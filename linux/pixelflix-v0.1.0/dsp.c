@@ -0,0 +1,73 @@
+#include "dsp.h"
+#include "logger.h"
+#include <string.h>
+#include <math.h>
+#include <libavutil/common.h>
+
+//set up the stage for packed PCM, with peaking bands (RBJ cookbook) and the volume at 0 dB
+//return 1 on success, 0 if the format or channel count isn't supported
+int dspInit(Dsp* dsp , enum AVSampleFormat fmt , int channels , int freq , const DspBand* bands , int nbBands)
+{
+    double a , w , alpha , a0;
+    memset(dsp , 0 , sizeof(*dsp));
+    if (!biquadChunkInit(&dsp->chunk , fmt , channels , true)) return 0;
+    for (int i = 0; i < nbBands && dsp->nbBands < DSP_MAX_BANDS; i++)
+    {
+        //a band at or past Nyquist can't be built, flat bands cost time for nothing
+        if (bands[i].freq <= 0 || bands[i].freq >= freq / 2.0 || bands[i].q <= 0 || bands[i].gain == 0) continue;
+        a = pow(10 , bands[i].gain / 40);
+        w = 2 * M_PI * bands[i].freq / freq;
+        alpha = sin(w) / (2 * bands[i].q);
+        a0 = 1 + alpha / a;
+        dsp->coef[dsp->nbBands][0] = (1 + alpha * a) / a0;
+        dsp->coef[dsp->nbBands][1] = -2 * cos(w) / a0;
+        dsp->coef[dsp->nbBands][2] = (1 - alpha * a) / a0;
+        dsp->coef[dsp->nbBands][3] = -2 * cos(w) / a0;
+        dsp->coef[dsp->nbBands][4] = (1 - alpha / a) / a0;
+        dsp->nbBands++;
+    }
+    dsp->rampLen = FFMAX((int)lrint(freq * DSP_RAMP) , 1);
+    dsp->gain = dsp->target = 1;
+    logger(LOG , "DSP: %d equalizer bands%s." , dsp->nbBands , dsp->chunk.wide ? ", S32 in double" : "");
+    return 1;
+}
+
+//1 if dspProcess() would change PCM at this volume, 0 if the stage is flat
+int dspActive(const Dsp* dsp , float volume)
+{
+    return dsp->nbBands > 0 || dsp->rampLeft > 0 || dsp->gain != 1 || volume != 1;
+}
+
+//equalize `len` bytes of PCM and scale them by the linear volume, in place.
+//A new volume is reached over DSP_RAMP, a frame at a time. At unity with no band
+//the PCM isn't touched at all
+void dspProcess(Dsp* dsp , uint8_t* buf , int len , float volume)
+{
+    BiquadChunk* ch = &dsp->chunk;
+    int frame = av_get_bytes_per_sample(ch->fmt) * ch->channels;
+    int frames = len / frame;
+    int n , k;
+    if (!dspActive(dsp , volume)) return;
+    if (volume != dsp->target)
+    {
+        dsp->target = volume;
+        dsp->rampLeft = dsp->rampLen;
+        dsp->step = (dsp->target - dsp->gain) / dsp->rampLen;
+    }
+    for (int done = 0; done < frames; done += n)
+    {
+        n = FFMIN(frames - done , BIQUAD_CHUNK);
+        biquadLoad(ch , buf + (size_t)done * frame , n);
+        for (int b = 0; b < dsp->nbBands; b++) biquadRun(ch , n , dsp->coef[b] , &dsp->z[b][0][0]);
+        //ramp for what is left of it, then the steady gain
+        k = FFMIN(n , dsp->rampLeft);
+        if (k > 0)
+        {
+            biquadRamp(ch , 0 , k , dsp->gain , dsp->step);
+            dsp->rampLeft -= k;
+            dsp->gain = dsp->rampLeft > 0 ? dsp->gain + k * dsp->step : dsp->target;
+        }
+        if (k < n && dsp->gain != 1) biquadRamp(ch , k , n - k , dsp->gain , 0);
+        biquadStore(ch , buf + (size_t)done * frame , n);
+    }
+}
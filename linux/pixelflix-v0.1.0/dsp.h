@@ -0,0 +1,39 @@
+#ifndef DSP_H__
+#define DSP_H__
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+#include "biquad.h"
+
+//volume and equalizer for the audio decode thread: runs in place on the converted PCM
+//before it goes to the ring, through the biquad stage
+#define DSP_MAX_BANDS 10
+#define DSP_RAMP 0.02 //seconds a volume change is spread over, no click
+#define DSP_VOLUME_MIN -60.0 //dB
+#define DSP_VOLUME_MAX 12.0 //dB
+
+//a peaking band
+typedef struct DspBand
+{
+    double freq;//centre, Hz
+    double gain;//dB
+    double q;
+}DspBand;
+
+typedef struct Dsp
+{
+    BiquadChunk chunk;//the PCM being processed, S32 in double
+    int nbBands;
+    double coef[DSP_MAX_BANDS][5];//b0 b1 b2 a1 a2 per band
+    double z[DSP_MAX_BANDS][2][BIQUAD_LANES];//transposed direct form II state
+    int rampLen;//frames
+    int rampLeft;//frames until gain reaches target
+    float gain;//linear gain applied now
+    float target;
+    float step;//gain change per frame while ramping
+}Dsp;
+
+int dspInit(Dsp* dsp , enum AVSampleFormat fmt , int channels , int freq , const DspBand* bands , int nbBands);
+void dspProcess(Dsp* dsp , uint8_t* buf , int len , float volume);
+int dspActive(const Dsp* dsp , float volume);
+
+#endif
@@ -0,0 +1,290 @@
+#include "loudness.h"
+#include "mix.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <libavutil/common.h>
+#include <libavutil/channel_layout.h>
+
+//loudness of a weighted mean square, LUFS
+static double loudnessOf(double power)
+{
+    return power > 0 ? -0.691 + 10 * log10(power) : -HUGE_VAL;
+}
+
+//mean square a histogram bin stands for, at its centre
+static double loudnessBinPower(int bin)
+{
+    return pow(10 , (LOUDNESS_HIST_MIN + (bin + 0.5) * LOUDNESS_HIST_STEP + 0.691) / 10);
+}
+
+//mean of the last n sub-blocks, fewer if there aren't that many yet
+static double loudnessMean(const Loudness* ld , int n)
+{
+    double sum = 0;
+    if ((uint64_t)n > ld->nsub) n = (int)ld->nsub;
+    if (n == 0) return 0;
+    for (int i = 1; i <= n; i++) sum += ld->sub[(ld->nsub - i) % LOUDNESS_SHORT_SUBS];
+    return sum / n;
+}
+
+//K-weighting coefficients at any sample rate, from the analog prototypes of BS.1770
+static void loudnessCoefficients(Loudness* ld , int freq)
+{
+    double f0 = 1681.974450955533 , q = 0.7071752369554196 , g = 3.999843853973347;
+    double k = tan(M_PI * f0 / freq);
+    double vh = pow(10 , g / 20) , vb = pow(vh , 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    ld->coef[0][0] = (vh + vb * k / q + k * k) / a0;
+    ld->coef[0][1] = 2 * (k * k - vh) / a0;
+    ld->coef[0][2] = (vh - vb * k / q + k * k) / a0;
+    ld->coef[0][3] = 2 * (k * k - 1) / a0;
+    ld->coef[0][4] = (1 - k / q + k * k) / a0;
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / freq);
+    a0 = 1 + k / q + k * k;
+    ld->coef[1][0] = 1;
+    ld->coef[1][1] = -2;
+    ld->coef[1][2] = 1;
+    ld->coef[1][3] = 2 * (k * k - 1) / a0;
+    ld->coef[1][4] = (1 - k / q + k * k) / a0;
+}
+
+//set up the meter for packed PCM of the given layout, the gain starts at 0 dB
+//return 1 on success, 0 if the format or channel count isn't supported
+int loudnessInit(Loudness* ld , enum AVSampleFormat fmt , int channels , int64_t layout , int freq , double target)
+{
+    uint64_t ch;
+    memset(ld , 0 , sizeof(*ld));
+    if (!biquadChunkInit(&ld->chunk , fmt , channels , false)) return 0;
+    ld->subLen = (int)lrint(freq * LOUDNESS_SUB);
+    ld->alpha = 1 - exp(-LOUDNESS_SUB / LOUDNESS_SMOOTH);
+    ld->target = target;
+    loudnessCoefficients(ld , freq);
+    for (int c = 0; c < channels; c++)
+    {
+        ch = layout ? av_channel_layout_extract_channel(layout , c) : 0;
+        if (ch == AV_CH_LOW_FREQUENCY) ld->weight[c] = 0;
+        else if (ch == AV_CH_BACK_LEFT || ch == AV_CH_BACK_RIGHT || ch == AV_CH_SIDE_LEFT || ch == AV_CH_SIDE_RIGHT) ld->weight[c] = 1.41f;
+        else ld->weight[c] = 1;
+    }
+    ld->ref = NAN;
+    return 1;
+}
+
+//a new file starts: the measurement starts over, the gain carries on from the last file.
+//`cached` is the file's integrated loudness from an earlier play, NAN if there is none,
+//with it the gain is right from the first sample
+void loudnessStart(Loudness* ld , double cached)
+{
+    memset(ld->z , 0 , sizeof(ld->z));
+    memset(ld->sum , 0 , sizeof(ld->sum));
+    memset(ld->hist , 0 , sizeof(ld->hist));
+    ld->subFill = 0;
+    ld->nsub = 0;
+    ld->blocks = 0;
+    ld->ref = cached;
+    ld->cached = !isnan(cached);
+    if (ld->cached) ld->gain = av_clipd(ld->target - cached , -LOUDNESS_MAX_CUT , LOUDNESS_MAX_BOOST);
+}
+
+//a sub-block is complete: fold it into the windows and the gating histogram, move the gain
+static void loudnessSubBlock(Loudness* ld)
+{
+    double power = 0 , block;
+    int bin;
+    for (int c = 0; c < ld->chunk.channels; c++)
+    {
+        power += ld->weight[c] * ld->sum[c] / ld->subLen;
+        ld->sum[c] = 0;
+    }
+    ld->sub[ld->nsub % LOUDNESS_SHORT_SUBS] = power;
+    ld->nsub++;
+    ld->subFill = 0;
+    //gating blocks are 400 ms long and start every 100 ms
+    if (ld->nsub >= 4)
+    {
+        block = loudnessOf(loudnessMean(ld , 4));
+        if (block >= LOUDNESS_HIST_MIN)
+        {
+            bin = (int)FFMIN((block - LOUDNESS_HIST_MIN) / LOUDNESS_HIST_STEP , LOUDNESS_HIST_BINS - 1);
+            ld->hist[bin]++;
+            ld->blocks++;
+        }
+    }
+    if (!ld->cached && ld->blocks >= LOUDNESS_MIN_BLOCKS) ld->ref = loudnessIntegrated(ld);
+    if (!isnan(ld->ref))
+        ld->gain += ld->alpha * (av_clipd(ld->target - ld->ref , -LOUDNESS_MAX_CUT , LOUDNESS_MAX_BOOST) - ld->gain);
+}
+
+//measure `len` bytes of PCM, then scale them in place by the current gain
+void loudnessProcess(Loudness* ld , uint8_t* buf , int len)
+{
+    BiquadChunk* ch = &ld->chunk;
+    int frame = av_get_bytes_per_sample(ch->fmt) * ch->channels;
+    int frames = len / frame;
+    int n;
+    float g;
+    for (int done = 0; done < frames; done += n)
+    {
+        n = FFMIN(FFMIN(frames - done , BIQUAD_CHUNK) , ld->subLen - ld->subFill);
+        //K-weighting: high shelf then high pass, then the mean square
+        biquadLoad(ch , buf + (size_t)done * frame , n);
+        biquadRun(ch , n , ld->coef[0] , &ld->z[0][0][0]);
+        biquadRun(ch , n , ld->coef[1] , &ld->z[1][0][0]);
+        biquadPower(ch , n , ld->sum);
+        ld->subFill += n;
+        if (ld->subFill == ld->subLen) loudnessSubBlock(ld);
+    }
+    //x * g done as x + x * (g - 1) by the saturating mixer, in place
+    g = powf(10 , (float)ld->gain / 20);
+    if (fabsf(g - 1) > 1e-4f) mixAdd(ch->fmt , buf , buf , frames * ch->channels , g - 1);
+}
+
+//loudness of the last 400 ms, LUFS
+double loudnessMomentary(const Loudness* ld)
+{
+    return loudnessOf(loudnessMean(ld , 4));
+}
+
+//loudness of the last 3 s, LUFS
+double loudnessShortTerm(const Loudness* ld)
+{
+    return loudnessOf(loudnessMean(ld , LOUDNESS_SHORT_SUBS));
+}
+
+//gated loudness of everything measured since loudnessStart(), LUFS, NAN before the first block:
+//blocks under -70 LUFS are dropped, then blocks 10 LU under the mean of the rest
+double loudnessIntegrated(const Loudness* ld)
+{
+    double sum = 0 , gate;
+    uint64_t n = 0;
+    int first;
+    if (ld->blocks == 0) return NAN;
+    for (int i = 0; i < LOUDNESS_HIST_BINS; i++) sum += ld->hist[i] * loudnessBinPower(i);
+    gate = loudnessOf(sum / ld->blocks) - 10;
+    first = (int)FFMAX(ceil((gate - LOUDNESS_HIST_MIN) / LOUDNESS_HIST_STEP) , 0);
+    sum = 0;
+    for (int i = first; i < LOUDNESS_HIST_BINS; i++)
+    {
+        sum += ld->hist[i] * loudnessBinPower(i);
+        n += ld->hist[i];
+    }
+    return n ? loudnessOf(sum / n) : NAN;
+}
+
+//seconds measured since loudnessStart()
+double loudnessMeasured(const Loudness* ld)
+{
+    return ld->nsub * LOUDNESS_SUB;
+}
+
+//---------------------------------------------------------------------------
+//integrated loudness cache: one line "size mtime lufs path" per measured file, the file
+//is identified by its absolute path, size and modification time. A path has one line at
+//most, oldest first, and the cache holds LOUDNESS_CACHE_MAX of them
+
+static int loudnessCacheFile(char* file , size_t size)
+{
+    const char* dir = getenv("XDG_CACHE_HOME");
+    if (dir && dir[0]) return snprintf(file , size , "%s/pixelflix-loudness" , dir) < (int)size;
+    dir = getenv("HOME");
+    if (!dir || !dir[0] || snprintf(file , size , "%s/.cache" , dir) >= (int)size) return 0;
+    mkdir(file , 0700);
+    return snprintf(file , size , "%s/.cache/pixelflix-loudness" , dir) < (int)size;
+}
+
+//split a cache line, *path points into it
+//return 1 if it is well formed
+static int loudnessCacheParse(char* line , long long* size , long long* mtime , double* lufs , const char** path)
+{
+    int pos;
+    line[strcspn(line , "\n")] = '\0';
+    if (sscanf(line , "%lld %lld %lf %n" , size , mtime , lufs , &pos) != 3 || !line[pos]) return 0;
+    *path = line + pos;
+    return 1;
+}
+
+//1 and *lufs set if the file was measured before, 0 otherwise
+int loudnessCacheGet(const char* path , double* lufs)
+{
+    char abs[PATH_MAX] , file[PATH_MAX] , line[PATH_MAX + 64];
+    const char* p;
+    long long size , mtime;
+    double v;
+    int found = 0;
+    struct stat st;
+    FILE* f;
+    if (!realpath(path , abs) || stat(abs , &st) || !loudnessCacheFile(file , sizeof(file))) return 0;
+    if (!(f = fopen(file , "r"))) return 0;
+    while (!found && fgets(line , sizeof(line) , f))
+    {
+        if (loudnessCacheParse(line , &size , &mtime , &v , &p) && strcmp(p , abs) == 0 &&
+            size == (long long)st.st_size && mtime == (long long)st.st_mtime)
+        {
+            *lufs = v;
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+//remember a file's integrated loudness: the cache is rewritten without the path's old line
+//and the oldest lines past LOUDNESS_CACHE_MAX, then renamed over the old one, so a reader
+//or another player never sees it half written
+//return 1 on success, 0 on failure
+int loudnessCachePut(const char* path , double lufs)
+{
+    char abs[PATH_MAX] , file[PATH_MAX] , tmp[PATH_MAX + 8] , line[PATH_MAX + 64];
+    const char* p;
+    long long size , mtime;
+    double v;
+    int lines = 0 , skip , fd;
+    struct stat st;
+    FILE* in;
+    FILE* out;
+    if (isnan(lufs) || !realpath(path , abs) || stat(abs , &st) || !loudnessCacheFile(file , sizeof(file))) return 0;
+    snprintf(tmp , sizeof(tmp) , "%s.XXXXXX" , file);
+    if ((fd = mkstemp(tmp)) < 0 || !(out = fdopen(fd , "w")))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(tmp);
+        }
+        logger(LOG , "Failed to write the loudness cache %s." , file);
+        return 0;
+    }
+    //the other paths' lines, first counted then copied, all but the oldest that don't fit
+    if ((in = fopen(file , "r")))
+    {
+        while (fgets(line , sizeof(line) , in))
+        {
+            if (loudnessCacheParse(line , &size , &mtime , &v , &p) && strcmp(p , abs) != 0) lines++;
+        }
+        skip = FFMAX(lines - (LOUDNESS_CACHE_MAX - 1) , 0);
+        rewind(in);
+        while (fgets(line , sizeof(line) , in))
+        {
+            if (!loudnessCacheParse(line , &size , &mtime , &v , &p) || strcmp(p , abs) == 0) continue;
+            if (skip > 0) skip--;
+            else fprintf(out , "%lld %lld %.2f %s\n" , size , mtime , v , p);
+        }
+        fclose(in);
+    }
+    fprintf(out , "%lld %lld %.2f %s\n" , (long long)st.st_size , (long long)st.st_mtime , lufs , abs);
+    if (fclose(out) || rename(tmp , file))
+    {
+        unlink(tmp);
+        logger(LOG , "Failed to write the loudness cache %s." , file);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,54 @@
+#ifndef LOUDNESS_H__
+#define LOUDNESS_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavutil/samplefmt.h>
+#include "biquad.h"
+
+//EBU R128 loudness meter and normalizer for the audio decode thread: measures the
+//converted PCM and scales it in place so every file plays at the same loudness
+
+#define LOUDNESS_SUB 0.1 //seconds per sub-block, a 400 ms gating block is 4 of them
+#define LOUDNESS_SHORT_SUBS 30 //sub-blocks in the 3 s short-term window
+#define LOUDNESS_HIST_MIN -70.0 //absolute gate, LUFS
+#define LOUDNESS_HIST_STEP 0.1 //LU per histogram bin
+#define LOUDNESS_HIST_BINS 750 //up to +5 LUFS
+#define LOUDNESS_MIN_BLOCKS 30 //gated blocks before the running integrated value steers the gain
+#define LOUDNESS_SMOOTH 3.0 //seconds, time constant of the gain
+#define LOUDNESS_MAX_BOOST 12.0 //dB
+#define LOUDNESS_MAX_CUT 30.0 //dB
+#define LOUDNESS_CACHE_MIN 10.0 //seconds measured before a file's integrated value is cached
+#define LOUDNESS_CACHE_MAX 4096 //files remembered, the least recently measured go first
+
+typedef struct Loudness
+{
+    BiquadChunk chunk;//the PCM being measured, as float
+    int subLen;//frames per sub-block
+    double alpha;//gain smoothing per sub-block
+    double target;//LUFS
+    //K-weighting: high shelf then high pass, b0 b1 b2 a1 a2 each
+    double coef[2][5];
+    double z[2][2][BIQUAD_LANES];//filter state per stage
+    float weight[BIQUAD_LANES];//channel weights, surrounds +1.5 dB, LFE not counted
+    float sum[BIQUAD_LANES];//squared K-weighted samples of the current sub-block
+    int subFill;
+    double sub[LOUDNESS_SHORT_SUBS];//weighted mean squares of the last sub-blocks, a ring
+    uint64_t nsub;//sub-blocks since the reset
+    uint32_t hist[LOUDNESS_HIST_BINS];//gating blocks by loudness, for the integrated value
+    uint64_t blocks;//gating blocks in hist
+    double ref;//loudness the gain normalizes from, NAN until known
+    bool cached;//ref came from the cache, the running value doesn't replace it
+    double gain;//dB applied now
+}Loudness;
+
+int loudnessInit(Loudness* ld , enum AVSampleFormat fmt , int channels , int64_t layout , int freq , double target);
+void loudnessStart(Loudness* ld , double cached);
+void loudnessProcess(Loudness* ld , uint8_t* buf , int len);
+double loudnessMomentary(const Loudness* ld);
+double loudnessShortTerm(const Loudness* ld);
+double loudnessIntegrated(const Loudness* ld);
+double loudnessMeasured(const Loudness* ld);
+int loudnessCacheGet(const char* path , double* lufs);
+int loudnessCachePut(const char* path , double lufs);
+
+#endif
@@ -9,15 +9,157 @@
  *version: 0.1.0
  *  Audio-video synchronization.
  *
+ *usage:
+ *  pixelflix [-s WxH] [-a] [-v] [-d] [-L ms] [-x] [-S clock] [-r rate] [-M g0,g1,...] [-n LUFS] [-V dB] [-e f:g:q,...] file
+ *  pixelflix [-s WxH] [-j N] file1 file2 ...
+ *  pixelflix -p [-v] [-d] [-L ms] [-x] [-r rate] [-n LUFS] [-V dB] [-e f:g:q,...] file1 file2 ...
+ *  -s WxH  open a WxH window and decode/convert at that size (thumbnail tiles)
+ *  -j N    mosaic worker pool size, one per cpu by default
+ *  -d      TPDF dither when audio is reduced to 16 bit
+ *  -L ms   audio output latency past SDL's buffers, for A/V sync on HDMI or bluetooth
+ *  -a      audio only: no window, no video decoding (automatic for files without video)
+ *  -v      spectrum visualizer window for audio only playback
+ *  -x      sync to the system clock, audio drift is corrected by resampling (same as -S external)
+ *  -S clock  sync master: audio (default), external, or video to check frame timing; the others follow it
+ *  -r rate playback speed 0.25-4, pitch is kept; [ and ] change it while playing, \ resets it
+ *  -p      play the files' audio one after another without gaps, as a playlist
+ *  -M g0,g1,...  mix the file's first audio streams (e.g. commentary over the main mix), each at its gain
+ *  -n LUFS normalize loudness to LUFS (EBU R128, e.g. -23), measured values are cached per file
+ *  -V dB   start at this volume, -60 to +12; up and down change it while playing, M mutes
+ *  -e f:g:q,...  equalizer: a peaking band at f Hz with g dB of gain and quality q, each
+ *  Several files are played as a mosaic grid in one window, unless -p is given.
+ *  Left and right seek 10 seconds back and forth to the nearest keyframe, with shift to the exact frame.
+ *  A switches to the file's next audio stream (language) while playing.
+ *  Space pauses and resumes, Esc quits.
+ *
  ************************************************************************/
 #include "logger.h"
 #include "player.h"
+#include "mosaic.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
  //main thread
 int main(int argc , char* argv[])
 {
-    if (argc < 2) logger(EXIT_FAILURE , "Need a file path.");
-    const char* path = argv[1];
-    playerRun(path);
+    PlayerOptions opts = { 0 };
+    int opt;
+    bool playlist = false;
+    char* end;
+    while ((opt = getopt(argc , argv , "s:j:dL:xS:r:avpM:n:V:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+        {
+            if (sscanf(optarg , "%dx%d" , &opts.win_w , &opts.win_h) != 2 || opts.win_w <= 0 || opts.win_h <= 0)
+                logger(EXIT_FAILURE , "Bad window size: %s" , optarg);
+            opts.fitWindow = true;
+            break;
+        }
+        case 'j':
+        {
+            opts.poolThreads = atoi(optarg);
+            break;
+        }
+        case 'd':
+        {
+            opts.dither = true;
+            break;
+        }
+        case 'L':
+        {
+            opts.audioLatency = atof(optarg) / 1000.0;
+            break;
+        }
+        case 'a':
+        {
+            opts.audioOnly = true;
+            break;
+        }
+        case 'v':
+        {
+            opts.visualize = true;
+            break;
+        }
+        case 'x':
+        {
+            opts.master = SYNC_EXTERNAL;
+            break;
+        }
+        case 'p':
+        {
+            playlist = true;
+            break;
+        }
+        case 'M':
+        {
+            for (end = optarg; opts.mixTracks < MIX_MAX_TRACKS; end++)
+            {
+                opts.mixGain[opts.mixTracks] = strtof(end , &end);
+                if (opts.mixGain[opts.mixTracks] < 0 || opts.mixGain[opts.mixTracks] > 16) logger(EXIT_FAILURE , "Bad mix gain: %s" , optarg);
+                opts.mixTracks++;
+                if (*end != ',') break;
+            }
+            if (*end != '\0') logger(EXIT_FAILURE , "Bad mix gains: %s" , optarg);
+            break;
+        }
+        case 'n':
+        {
+            opts.normalize = true;
+            opts.loudnessTarget = strtod(optarg , &end);
+            if (*end != '\0' || opts.loudnessTarget < -50 || opts.loudnessTarget > 0) logger(EXIT_FAILURE , "Bad loudness target: %s" , optarg);
+            break;
+        }
+        case 'S':
+        {
+            if (strcmp(optarg , "audio") == 0) opts.master = SYNC_AUDIO;
+            else if (strcmp(optarg , "video") == 0) opts.master = SYNC_VIDEO;
+            else if (strcmp(optarg , "external") == 0) opts.master = SYNC_EXTERNAL;
+            else logger(EXIT_FAILURE , "Bad sync master: %s" , optarg);
+            break;
+        }
+        case 'V':
+        {
+            opts.volume = strtod(optarg , &end);
+            if (*end != '\0' || opts.volume < DSP_VOLUME_MIN || opts.volume > DSP_VOLUME_MAX) logger(EXIT_FAILURE , "Bad volume: %s" , optarg);
+            break;
+        }
+        case 'e':
+        {
+            for (end = optarg; opts.eqBands < DSP_MAX_BANDS; end++)
+            {
+                DspBand* b = &opts.eq[opts.eqBands++];
+                if (sscanf(end , "%lf:%lf:%lf" , &b->freq , &b->gain , &b->q) != 3 || b->freq <= 0 || b->q <= 0 ||
+                    b->gain < -24 || b->gain > 24)
+                    logger(EXIT_FAILURE , "Bad equalizer band: %s" , end);
+                end += strcspn(end , ",");
+                if (*end != ',') break;
+            }
+            if (*end != '\0') logger(EXIT_FAILURE , "Bad equalizer bands: %s" , optarg);
+            break;
+        }
+        case 'r':
+        {
+            opts.speed = atof(optarg);
+            if (opts.speed < 0.25 || opts.speed > 4) logger(EXIT_FAILURE , "Bad playback speed: %s" , optarg);
+            break;
+        }
+        default:
+            logger(EXIT_FAILURE , "Usage: %s [-s WxH] [-j N] [-d] [-a] [-v] [-L ms] [-x] [-S clock] [-r rate] [-p] [-M g0,g1,...] [-n LUFS] [-V dB] [-e f:g:q,...] file..." , argv[0]);
+        }
+    }
+    if (optind >= argc) logger(EXIT_FAILURE , "Need a file path.");
+    if (playlist && opts.mixTracks > 0) logger(EXIT_FAILURE , "A playlist plays one audio stream per file, it can't mix.");
+    if (playlist)
+    {
+        opts.audioOnly = true;
+        opts.playlist = (const char**)&argv[optind + 1];
+        opts.playlistLen = argc - optind - 1;
+    }
+    else if (argc - optind > 1) return mosaicRun((const char**)&argv[optind] , argc - optind , &opts);
+    const char* path = argv[optind];
+    playerRun(path , &opts);
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,247 @@
+#include "mix.h"
+#include "logger.h"
+#include <math.h>
+#include <libavutil/cpu.h>
+#include <libavutil/common.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+//kernels, one set per instruction set, picked at runtime by mixInit().
+//dst += src * gain on n interleaved samples, clipped to the format's range
+//instead of wrapping. Integer formats are mixed in float (S16) or double (S32),
+//which hold every sum exactly enough
+
+typedef struct MixKernels
+{
+    const char* name;
+    void (*s16)(int16_t* dst , const int16_t* src , float gain , int n);
+    void (*s32)(int32_t* dst , const int32_t* src , float gain , int n);
+    void (*flt)(float* dst , const float* src , float gain , int n);
+}MixKernels;
+
+static void mixS16C(int16_t* dst , const int16_t* src , float gain , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = av_clip_int16(lrintf(dst[i] + src[i] * gain));
+}
+
+static void mixS32C(int32_t* dst , const int32_t* src , float gain , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = (int32_t)llrint(av_clipd(dst[i] + (double)src[i] * gain , INT32_MIN , INT32_MAX));
+}
+
+static void mixFltC(float* dst , const float* src , float gain , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = av_clipf(dst[i] + src[i] * gain , -1.0f , 1.0f);
+}
+
+static const MixKernels kernelsC = { "c" , mixS16C , mixS32C , mixFltC };
+
+#if defined(__x86_64__)
+//S16 -> 2x4 float, sign extended by an arithmetic shift
+static inline void mixWidenS16(__m128i v , __m128* lo , __m128* hi)
+{
+    *lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v , v) , 16));
+    *hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v , v) , 16));
+}
+
+static void mixS16SSE2(int16_t* dst , const int16_t* src , float gain , int n)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    __m128 dl , dh , sl , sh;
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        mixWidenS16(_mm_loadu_si128((const __m128i*)(dst + i)) , &dl , &dh);
+        mixWidenS16(_mm_loadu_si128((const __m128i*)(src + i)) , &sl , &sh);
+        dl = _mm_add_ps(dl , _mm_mul_ps(sl , g));
+        dh = _mm_add_ps(dh , _mm_mul_ps(sh , g));
+        //packs saturates to S16
+        _mm_storeu_si128((__m128i*)(dst + i) , _mm_packs_epi32(_mm_cvtps_epi32(dl) , _mm_cvtps_epi32(dh)));
+    }
+    mixS16C(dst + i , src + i , gain , n - i);
+}
+
+static void mixS32SSE2(int32_t* dst , const int32_t* src , float gain , int n)
+{
+    const __m128d g = _mm_set1_pd(gain);
+    const __m128d lo = _mm_set1_pd(INT32_MIN);
+    const __m128d hi = _mm_set1_pd(INT32_MAX);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128d v0 = _mm_add_pd(_mm_cvtepi32_pd(d) , _mm_mul_pd(_mm_cvtepi32_pd(s) , g));
+        __m128d v1 = _mm_add_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(d , 0xEE)) , _mm_mul_pd(_mm_cvtepi32_pd(_mm_shuffle_epi32(s , 0xEE)) , g));
+        v0 = _mm_min_pd(_mm_max_pd(v0 , lo) , hi);
+        v1 = _mm_min_pd(_mm_max_pd(v1 , lo) , hi);
+        _mm_storeu_si128((__m128i*)(dst + i) , _mm_unpacklo_epi64(_mm_cvtpd_epi32(v0) , _mm_cvtpd_epi32(v1)));
+    }
+    mixS32C(dst + i , src + i , gain , n - i);
+}
+
+static void mixFltSSE2(float* dst , const float* src , float gain , int n)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_add_ps(_mm_loadu_ps(dst + i) , _mm_mul_ps(_mm_loadu_ps(src + i) , g));
+        _mm_storeu_ps(dst + i , _mm_min_ps(_mm_max_ps(v , lo) , hi));
+    }
+    mixFltC(dst + i , src + i , gain , n - i);
+}
+
+static const MixKernels kernelsSSE2 = { "sse2" , mixS16SSE2 , mixS32SSE2 , mixFltSSE2 };
+
+__attribute__((target("avx2")))
+static void mixS16AVX2(int16_t* dst , const int16_t* src , float gain , int n)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256 lo = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(d))) ,
+            _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(s))) , g));
+        __m256 hi = _mm256_add_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(d , 1))) ,
+            _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(s , 1))) , g));
+        //packs saturates within each 128 bit lane, the permute puts the halves back in order
+        __m256i p = _mm256_packs_epi32(_mm256_cvtps_epi32(lo) , _mm256_cvtps_epi32(hi));
+        _mm256_storeu_si256((__m256i*)(dst + i) , _mm256_permute4x64_epi64(p , 0xD8));
+    }
+    mixS16C(dst + i , src + i , gain , n - i);
+}
+
+__attribute__((target("avx2")))
+static void mixS32AVX2(int32_t* dst , const int32_t* src , float gain , int n)
+{
+    const __m256d g = _mm256_set1_pd(gain);
+    const __m256d lo = _mm256_set1_pd(INT32_MIN);
+    const __m256d hi = _mm256_set1_pd(INT32_MAX);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d v = _mm256_add_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(dst + i))) ,
+            _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(src + i))) , g));
+        v = _mm256_min_pd(_mm256_max_pd(v , lo) , hi);
+        _mm_storeu_si128((__m128i*)(dst + i) , _mm256_cvtpd_epi32(v));
+    }
+    mixS32C(dst + i , src + i , gain , n - i);
+}
+
+__attribute__((target("avx2")))
+static void mixFltAVX2(float* dst , const float* src , float gain , int n)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    const __m256 lo = _mm256_set1_ps(-1.0f);
+    const __m256 hi = _mm256_set1_ps(1.0f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_add_ps(_mm256_loadu_ps(dst + i) , _mm256_mul_ps(_mm256_loadu_ps(src + i) , g));
+        _mm256_storeu_ps(dst + i , _mm256_min_ps(_mm256_max_ps(v , lo) , hi));
+    }
+    mixFltC(dst + i , src + i , gain , n - i);
+}
+
+static const MixKernels kernelsAVX2 = { "avx2" , mixS16AVX2 , mixS32AVX2 , mixFltAVX2 };
+#endif
+
+#if defined(__aarch64__)
+static void mixS16NEON(int16_t* dst , const int16_t* src , float gain , int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x8_t d = vld1q_s16(dst + i);
+        int16x8_t s = vld1q_s16(src + i);
+        float32x4_t lo = vmlaq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(d))) , vcvtq_f32_s32(vmovl_s16(vget_low_s16(s))) , gain);
+        float32x4_t hi = vmlaq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(d))) , vcvtq_f32_s32(vmovl_s16(vget_high_s16(s))) , gain);
+        //saturating narrow to S16
+        vst1q_s16(dst + i , vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(lo)) , vqmovn_s32(vcvtnq_s32_f32(hi))));
+    }
+    mixS16C(dst + i , src + i , gain , n - i);
+}
+
+static void mixS32NEON(int32_t* dst , const int32_t* src , float gain , int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        int32x4_t d = vld1q_s32(dst + i);
+        int32x4_t s = vld1q_s32(src + i);
+        float64x2_t lo = vaddq_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(d))) , vmulq_n_f64(vcvtq_f64_s64(vmovl_s32(vget_low_s32(s))) , gain));
+        float64x2_t hi = vaddq_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(d))) , vmulq_n_f64(vcvtq_f64_s64(vmovl_s32(vget_high_s32(s))) , gain));
+        //saturating narrow to S32
+        vst1q_s32(dst + i , vcombine_s32(vqmovn_s64(vcvtnq_s64_f64(lo)) , vqmovn_s64(vcvtnq_s64_f64(hi))));
+    }
+    mixS32C(dst + i , src + i , gain , n - i);
+}
+
+static void mixFltNEON(float* dst , const float* src , float gain , int n)
+{
+    const float32x4_t lo = vdupq_n_f32(-1.0f);
+    const float32x4_t hi = vdupq_n_f32(1.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t v = vmlaq_n_f32(vld1q_f32(dst + i) , vld1q_f32(src + i) , gain);
+        vst1q_f32(dst + i , vminq_f32(vmaxq_f32(v , lo) , hi));
+    }
+    mixFltC(dst + i , src + i , gain , n - i);
+}
+
+static const MixKernels kernelsNEON = { "neon" , mixS16NEON , mixS32NEON , mixFltNEON };
+#endif
+
+static const MixKernels* kernels = &kernelsC;
+
+//---------------------------------------------------------------------------
+
+//pick the widest kernel set the cpu runs
+int mixInit(void)
+{
+    int flags = av_get_cpu_flags();
+    kernels = &kernelsC;
+#if defined(__x86_64__)
+    if (flags & AV_CPU_FLAG_AVX2) kernels = &kernelsAVX2;
+    else if (flags & AV_CPU_FLAG_SSE2) kernels = &kernelsSSE2;
+#elif defined(__aarch64__)
+    if (flags & AV_CPU_FLAG_NEON) kernels = &kernelsNEON;
+#else
+    (void)flags;
+#endif
+    logger(LOG , "Audio mixer kernels: %s" , kernels->name);
+    return 1;
+}
+
+//add n interleaved samples of src, scaled by gain, onto dst, both packed fmt
+//return 1 on success, 0 if fmt isn't a format the mixer handles
+int mixAdd(enum AVSampleFormat fmt , uint8_t* dst , const uint8_t* src , int n , float gain)
+{
+    switch (fmt)
+    {
+    case AV_SAMPLE_FMT_S16:
+        kernels->s16((int16_t*)dst , (const int16_t*)src , gain , n);
+        return 1;
+    case AV_SAMPLE_FMT_S32:
+        kernels->s32((int32_t*)dst , (const int32_t*)src , gain , n);
+        return 1;
+    case AV_SAMPLE_FMT_FLT:
+        kernels->flt((float*)dst , (const float*)src , gain , n);
+        return 1;
+    default:
+        return 0;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef MIX_H__
+#define MIX_H__
+#include <stdint.h>
+#include <libavutil/samplefmt.h>
+
+//saturating mixer for the audio decode thread: adds scaled PCM onto PCM in the
+//device format, so several audio streams play as one
+
+#define MIX_MAX_TRACKS 8 //streams mixed at most, the playing one included
+#define MIX_FIFO_SECONDS 2.0 //PCM a mixed stream may run ahead of the playing one
+#define MIX_HOLD_SECONDS 0.1 //how long the playing stream waits for a mixed stream's PCM, a few packets
+
+int mixInit(void);
+int mixAdd(enum AVSampleFormat fmt , uint8_t* dst , const uint8_t* src , int n , float gain);
+
+#endif
@@ -0,0 +1,341 @@
+#include "mosaic.h"
+#include "player.h"
+#include "video.h"
+#include "pool.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+#include <SDL2/SDL.h>
+
+#define MOSAIC_QUEUE_FRAMES 3 //decoded frames buffered per tile
+#define MOSAIC_DEFAULT_W 1280
+#define MOSAIC_DEFAULT_H 720
+
+//one input of the mosaic, it owns its own demux/decode state in `ps`
+typedef struct MosaicTile
+{
+    PlayerStatus ps;
+    SDL_Rect cell;//the tile's cell in the composite
+    SDL_Rect rect;//the picture inside the cell
+    struct SwsContext* swsCtx;
+    AVPacket* pkt;//reused by every decode step
+    AVFrame* frame;//reused by every decode step
+    double time_base;
+    double offset;//wall clock minus pts, fixed by the first frame shown
+    double last_pts;
+    bool started;
+    atomic_bool scheduled;//a decode step is queued or running on the pool
+}MosaicTile;
+
+static atomic_bool mosaic_quit;
+
+//pool job: demux and decode one tile until it produced a frame.
+//Only one step per tile is in flight, so the tile's contexts need no lock.
+static void mosaicStep(void* arg)
+{
+    MosaicTile* t = (MosaicTile*)arg;
+    PlayerStatus* ps = &t->ps;
+    Queue* vfq = &ps->vfq;
+    AVFrame* frame;
+    int produced = 0;
+    int ret;
+
+    while (!produced && !ps->isVideoDecodeFinished && !atomic_load(&mosaic_quit))
+    {
+        ret = av_read_frame(ps->fmtCtx , t->pkt);
+        if (ret == 0 && t->pkt->stream_index != ps->v_idx)
+        {
+            av_packet_unref(t->pkt);
+            continue;
+        }
+        //NULL flushes the decoder once the stream is over
+        avcodec_send_packet(ps->v_codecCtx , ret == 0 ? t->pkt : NULL);
+        av_packet_unref(t->pkt);
+        while ((ret = avcodec_receive_frame(ps->v_codecCtx , t->frame)) == 0)
+        {
+            frame = av_frame_alloc();
+            if (!frame) logger(EXIT_FAILURE , "Failed to alloc frame.");
+            av_frame_move_ref(frame , t->frame);
+            vfq->enqueue(vfq , frame);
+            produced++;
+        }
+        if (ret == AVERROR_EOF)
+        {
+            ps->isStreamFinished = true;
+            ps->isVideoDecodeFinished = true;
+        }
+    }
+    atomic_store(&t->scheduled , false);
+}
+
+static double mosaicPts(MosaicTile* t , AVFrame* f)
+{
+    if (f->best_effort_timestamp != AV_NOPTS_VALUE)
+        t->last_pts = f->best_effort_timestamp * t->time_base;
+    return t->last_pts;
+}
+
+//take the newest frame that is due at `now`, stale frames behind it are dropped.
+//NULL if the tile has nothing new to show.
+static AVFrame* mosaicNextFrame(MosaicTile* t , double now)
+{
+    Queue* vfq = &t->ps.vfq;
+    AVFrame* shown = NULL;
+    AVFrame* next;
+    double pts;
+
+    while (vfq->peek(vfq , (void**)&next))
+    {
+        pts = mosaicPts(t , next);
+        if (!t->started)
+        {
+            t->offset = now - pts;
+            t->started = true;
+        }
+        if (pts + t->offset > now) break;//not due yet
+        vfq->dequeue(vfq , (void**)&next);
+        if (shown) av_frame_free(&shown);
+        shown = next;
+    }
+    return shown;
+}
+
+//fill a rect of the composite with black
+static void mosaicClear(const SDL_Rect* r , uint8_t* data[4] , int linesize[4])
+{
+    for (int y = 0; y < r->h; y++)
+        memset(data[0] + (r->y + y) * linesize[0] + r->x , 16 , r->w);
+    for (int y = 0; y < r->h / 2; y++)
+    {
+        memset(data[1] + (r->y / 2 + y) * linesize[1] + r->x / 2 , 128 , r->w / 2);
+        memset(data[2] + (r->y / 2 + y) * linesize[2] + r->x / 2 , 128 , r->w / 2);
+    }
+}
+
+//scale the frame straight into the tile's place in the composite
+static void mosaicDraw(MosaicTile* t , AVFrame* f , uint8_t* data[4] , int linesize[4])
+{
+    int w , h;
+    uint8_t* dst[4];
+
+    videoFitSize(f->width , f->height , t->cell.w , t->cell.h , &w , &h);
+    if (w != t->rect.w || h != t->rect.h)
+    {
+        mosaicClear(&t->cell , data , linesize);
+        t->rect.w = w;
+        t->rect.h = h;
+        t->rect.x = t->cell.x + (((t->cell.w - w) / 2) & ~1);
+        t->rect.y = t->cell.y + (((t->cell.h - h) / 2) & ~1);
+    }
+    t->swsCtx = sws_getCachedContext(t->swsCtx ,
+        f->width ,
+        f->height ,
+        (enum AVPixelFormat)f->format ,
+        w ,
+        h ,
+        AV_PIX_FMT_YUV420P ,
+        SWS_BILINEAR ,
+        NULL ,
+        NULL ,
+        NULL
+    );
+    if (!t->swsCtx) logger(EXIT_FAILURE , "Falied to initilize sws context.");
+    dst[0] = data[0] + t->rect.y * linesize[0] + t->rect.x;
+    dst[1] = data[1] + t->rect.y / 2 * linesize[1] + t->rect.x / 2;
+    dst[2] = data[2] + t->rect.y / 2 * linesize[2] + t->rect.x / 2;
+    dst[3] = NULL;
+    sws_scale(t->swsCtx , (const uint8_t* const*)f->data , f->linesize , 0 , f->height , dst , linesize);
+}
+
+static void mosaicClose(MosaicTile* t)
+{
+    PlayerStatus* ps = &t->ps;
+    AVFrame* frame;
+    while (ps->vfq.peek(&ps->vfq , (void**)&frame))
+    {
+        ps->vfq.dequeue(&ps->vfq , (void**)&frame);
+        av_frame_free(&frame);
+    }
+    sws_freeContext(t->swsCtx);
+    av_packet_free(&t->pkt);
+    av_frame_free(&t->frame);
+    avcodec_free_context(&ps->v_codecCtx);
+    avformat_close_input(&ps->fmtCtx);
+}
+
+//1 if the file opens and has a video stream a tile can show, cover art doesn't count (see playerOpen())
+static int mosaicHasVideo(const char* path)
+{
+    AVFormatContext* fmtCtx = NULL;
+    int res = 0;
+    if (avformat_open_input(&fmtCtx , path , NULL , NULL) == 0 && avformat_find_stream_info(fmtCtx , NULL) >= 0)
+    {
+        for (uint32_t i = 0; i < fmtCtx->nb_streams && !res; i++)
+        {
+            res = fmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+                !(fmtCtx->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC);
+        }
+    }
+    avformat_close_input(&fmtCtx);
+    return res;
+}
+
+//play n files as a grid in one window. Inputs without video are skipped.
+//Every tile decodes at its cell size on a worker pool shared by all inputs,
+//and all tiles are composited into one streaming texture per vsync.
+int mosaicRun(const char** paths , int n , const PlayerOptions* opts)
+{
+    PlayerOptions tileOpts = *opts;
+    MosaicTile* tiles;
+    Pool pool;
+    int win_w = opts->win_w > 0 ? opts->win_w : MOSAIC_DEFAULT_W;
+    int win_h = opts->win_h > 0 ? opts->win_h : MOSAIC_DEFAULT_H;
+    int cols = 1;
+    int rows;
+    int nb_workers;
+    int finished;
+    bool running = true;
+    bool dirty;
+    double now;
+    AVFrame* frame;
+    SDL_Event event;
+    SDL_Window* win;
+    SDL_Renderer* renderer;
+    SDL_Texture* texture;
+    uint8_t* buffer;
+    uint8_t* data[4];
+    int linesize[4];
+    SDL_Rect all = { 0 , 0 , 0 , 0 };
+    const char** inputs;
+    int nb = 0;
+
+    if (n < 1) logger(EXIT_FAILURE , "Need a file path.");
+    //a tile shows video, audio only files have nothing to put in one
+    inputs = (const char**)av_malloc(sizeof(*inputs) * n);
+    if (!inputs) logger(EXIT_FAILURE , "Failed to alloc inputs.");
+    for (int i = 0; i < n; i++)
+    {
+        if (mosaicHasVideo(paths[i])) inputs[nb++] = paths[i];
+        else logger(LOG , "Mosaic: skipping %s, it has no video." , paths[i]);
+    }
+    if (nb == 0) logger(EXIT_FAILURE , "Mosaic: no input has video.");
+    paths = inputs;
+    n = nb;
+    while (cols * cols < n) cols++;
+    rows = (n + cols - 1) / cols;
+    win_w &= ~1;
+    win_h &= ~1;
+    logger(LOG , "Mosaic: %d inputs, %dx%d grid, %dx%d window" , n , cols , rows , win_w , win_h);
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER)) logger(EXIT_FAILURE , "Failed to init SDL subsystem.");
+
+    //open every input at its cell size, one decoder thread each, the pool does the parallelism
+    tiles = (MosaicTile*)av_mallocz(sizeof(MosaicTile) * n);
+    if (!tiles) logger(EXIT_FAILURE , "Failed to alloc tiles.");
+    for (int i = 0; i < n; i++)
+    {
+        MosaicTile* t = &tiles[i];
+        t->cell.w = (win_w / cols) & ~1;
+        t->cell.h = (win_h / rows) & ~1;
+        t->cell.x = (i % cols) * t->cell.w;
+        t->cell.y = (i / cols) * t->cell.h;
+        tileOpts.win_w = t->cell.w;
+        tileOpts.win_h = t->cell.h;
+        tileOpts.fitWindow = true;
+        tileOpts.mute = true;
+        tileOpts.audioOnly = false;
+        tileOpts.decodeThreads = 1;
+        playerOpen(&t->ps , paths[i] , &tileOpts);
+        t->pkt = av_packet_alloc();
+        t->frame = av_frame_alloc();
+        if (!t->pkt || !t->frame) logger(EXIT_FAILURE , "Failed to alloc tile packet.");
+        t->time_base = av_q2d(t->ps.fmtCtx->streams[t->ps.v_idx]->time_base);
+        atomic_init(&t->scheduled , false);
+    }
+    atomic_init(&mosaic_quit , false);
+    nb_workers = opts->poolThreads > 0 ? opts->poolThreads : SDL_GetCPUCount();
+    if (nb_workers > n) nb_workers = n;
+    if (!poolInit(&pool , nb_workers)) logger(EXIT_FAILURE , "Failed to start worker pool.");
+
+    win = SDL_CreateWindow("PixelFlix 简易视频播放器" ,
+        SDL_WINDOWPOS_UNDEFINED ,
+        SDL_WINDOWPOS_UNDEFINED ,
+        win_w ,
+        win_h ,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
+    );
+    if (!win) logger(EXIT_FAILURE , "Failed to create a window.");
+    //present blocks until vsync, that is the compositor's clock
+    renderer = SDL_CreateRenderer(win , -1 , SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) logger(EXIT_FAILURE , "Failed to create a renderer.");
+    texture = SDL_CreateTexture(renderer , SDL_PIXELFORMAT_IYUV , SDL_TEXTUREACCESS_STREAMING , win_w , win_h);
+    if (!texture) logger(EXIT_FAILURE , "Failed to create a texture.");
+    buffer = (uint8_t*)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P , win_w , win_h , 1));
+    if (!buffer) logger(EXIT_FAILURE , "Failed to alloc composite buffer.");
+    av_image_fill_arrays(data , linesize , buffer , AV_PIX_FMT_YUV420P , win_w , win_h , 1);
+    all.w = win_w;
+    all.h = win_h;
+    mosaicClear(&all , data , linesize);
+
+    while (running)
+    {
+        while (SDL_PollEvent(&event))
+        {
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE))
+            {
+                running = false;
+            }
+        }
+
+        now = av_gettime_relative() / 1000000.0;
+        dirty = false;
+        finished = 0;
+        for (int i = 0; i < n; i++)
+        {
+            MosaicTile* t = &tiles[i];
+            //keep a few frames decoded ahead, at most one step per tile in the pool
+            if (!t->ps.isVideoDecodeFinished && t->ps.vfq.n < MOSAIC_QUEUE_FRAMES && !atomic_load(&t->scheduled))
+            {
+                atomic_store(&t->scheduled , true);
+                if (!poolSubmit(&pool , mosaicStep , t)) atomic_store(&t->scheduled , false);
+            }
+            frame = mosaicNextFrame(t , now);
+            if (frame)
+            {
+                mosaicDraw(t , frame , data , linesize);
+                av_frame_free(&frame);
+                dirty = true;
+            }
+            if (t->ps.isVideoDecodeFinished && t->ps.vfq.n == 0) finished++;
+        }
+        if (finished == n) break;
+
+        //one upload for all tiles that changed since the last vsync
+        if (dirty) SDL_UpdateYUVTexture(texture , NULL , data[0] , linesize[0] , data[1] , linesize[1] , data[2] , linesize[2]);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer , texture , NULL , NULL);
+        SDL_RenderPresent(renderer);
+    }
+
+    atomic_store(&mosaic_quit , true);
+    poolDestroy(&pool);
+    for (int i = 0; i < n; i++)
+    {
+        mosaicClose(&tiles[i]);
+    }
+    av_free(tiles);
+    av_free(inputs);
+    av_free(buffer);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(win);
+    SDL_Quit();
+    return 0;
+}
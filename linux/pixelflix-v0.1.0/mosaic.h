@@ -0,0 +1,7 @@
+#ifndef MOSAIC_H__
+#define MOSAIC_H__
+#include "player.h"
+
+int mosaicRun(const char** paths , int n , const PlayerOptions* opts);
+
+#endif
@@ -6,6 +6,9 @@
 #include "queue.h"
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/frame.h>
@@ -20,10 +23,375 @@
 
 PlayerStatus player_status;
 
-//create demux thread and audio thread
+//monotonic time in seconds, the time base of every deadline
+double playerGetTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC , &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void playerStampWrite(ClockStamp* st , double pts , double at , double rate , int serial)
+{
+    unsigned int seq = atomic_load_explicit(&st->seq , memory_order_relaxed);
+    atomic_store_explicit(&st->seq , seq + 1 , memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    st->pts = pts;
+    st->at = at;
+    st->rate = rate;
+    st->serial = serial;
+    atomic_store_explicit(&st->seq , seq + 2 , memory_order_release);
+}
+
+//0 if the stamp was never written
+int playerStampRead(ClockStamp* st , double* pts , double* at , double* rate , int* serial)
+{
+    unsigned int seq;
+    do
+    {
+        seq = atomic_load_explicit(&st->seq , memory_order_acquire);
+        *pts = st->pts;
+        *at = st->at;
+        *rate = st->rate;
+        *serial = st->serial;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&st->seq , memory_order_relaxed));
+    return seq != 0;
+}
+
+//the monotonic time the clocks are read at: now, or when the player was paused
+double playerClockNow(PlayerStatus* ps)
+{
+    return atomic_load(&ps->paused) ? ps->pausedAt : playerGetTime();
+}
+
+//a clock's pts right now, NAN if it was never set or is on an older timeline than the player
+double playerClockGet(PlayerStatus* ps , SyncClock* c)
+{
+    double pts , at , rate;
+    int serial;
+    if (!playerStampRead(&c->stamp , &pts , &at , &rate , &serial) || serial != atomic_load(&ps->serial)) return NAN;
+    return pts + (playerClockNow(ps) - at) * rate;
+}
+
+//move a clock's stamp `dt` seconds later, so the time spent paused doesn't count.
+//Only the clock's writer may do it
+void playerClockShift(SyncClock* c , double dt)
+{
+    double pts , at , rate;
+    int serial;
+    if (playerStampRead(&c->stamp , &pts , &at , &rate , &serial)) playerStampWrite(&c->stamp , pts , at + dt , rate , serial);
+}
+
+//write a clock and, unless it is the master, note how far it is from the master
+void playerClockSet(PlayerStatus* ps , SyncClock* c , double pts , double at , double rate , int serial)
+{
+    double master , now;
+    bool isMaster = (c == &ps->audioClock && ps->master == SYNC_AUDIO) ||
+        (c == &ps->videoClock && ps->master == SYNC_VIDEO) || (c == &ps->extClock && ps->master == SYNC_EXTERNAL);
+    playerStampWrite(&c->stamp , pts , at , rate , serial);
+    master = isMaster ? NAN : playerMasterClock(ps);
+    now = playerClockGet(ps , c);
+    atomic_store(&c->drift , isnan(master) || isnan(now) ? 0.0 : now - master);
+}
+
+//the monotonic clock anchored by playerSetMasterClock(), NAN before that
+double playerExternalClock(PlayerStatus* ps)
+{
+    return playerClockGet(ps , &ps->extClock);
+}
+
+//pts on screen right now, NAN before the first frame of the timeline was presented
+double playerVideoClock(PlayerStatus* ps)
+{
+    return playerClockGet(ps , &ps->videoClock);
+}
+
+//media time in seconds being presented right now, NAN before the clock started.
+//The master's own clock rules once it runs, until then (start up, right after a seek)
+//the external clock anchored by whoever came first stands in
+double playerMasterClock(PlayerStatus* ps)
+{
+    double clock = NAN;
+    if (ps->master == SYNC_AUDIO) clock = audioGetClock(ps);
+    else if (ps->master == SYNC_VIDEO) clock = playerVideoClock(ps);
+    if (!isnan(clock)) return clock;
+    return playerExternalClock(ps);
+}
+
+//(re)anchor the external clock so `pts` is presented now. The stamps of the other
+//clocks belong to the old timeline from here on, they are stale until written again
+int playerSetMasterClock(PlayerStatus* ps , double pts)
+{
+    pthread_mutex_lock(&ps->clockLock);
+    atomic_fetch_add(&ps->serial , 1);
+    playerStampWrite(&ps->extClock.stamp , pts , playerClockNow(ps) , playerGetSpeed(ps) , atomic_load(&ps->serial));
+    pthread_mutex_unlock(&ps->clockLock);
+    return 1;
+}
+
+//start a new timeline: every clock is stale until written on it, the external clock
+//is anchored again by the first stage that plays something (playerStartClock())
+//return the new serial
+int playerResetClocks(PlayerStatus* ps)
+{
+    int serial;
+    pthread_mutex_lock(&ps->clockLock);
+    serial = atomic_fetch_add(&ps->serial , 1) + 1;
+    pthread_mutex_unlock(&ps->clockLock);
+    return serial;
+}
+
+//anchor the external clock at `pts` unless it already runs on the current timeline,
+//return 1 if it was anchored here
+int playerStartClock(PlayerStatus* ps , double pts)
+{
+    int started = 0;
+    pthread_mutex_lock(&ps->clockLock);
+    if (isnan(playerExternalClock(ps)))
+    {
+        playerStampWrite(&ps->extClock.stamp , pts , playerClockNow(ps) , playerGetSpeed(ps) , atomic_load(&ps->serial));
+        started = 1;
+    }
+    pthread_mutex_unlock(&ps->clockLock);
+    return started;
+}
+
+//seek to `pts` of playlist time, flags is PLAYER_SEEK_FAST or PLAYER_SEEK_ACCURATE.
+//The demux thread seeks the file, flushes the packet queues and starts a new clock serial
+//in one go; each decoder flushes itself at the serial's marker and everything older that is
+//still on its way is dropped by serial, so nothing from before the seek is played.
+//The time until the first frame (or sample) of the target is played is logged.
+//Paused, the pipeline runs until the target's first frame is shown, then parks again
+//return 1 if the seek was queued, 0 if it was ignored
+int playerSeek(PlayerStatus* ps , double pts , int flags)
+{
+    ps->seekFlags = flags;
+    ps->seekAt = playerGetTime();
+    //before the request is posted, so the demux thread can't start it first
+    pthread_mutex_lock(&ps->pauseLock);
+    if (atomic_load(&ps->paused))
+    {
+        atomic_store(&ps->pausedSeek , -1);
+        pthread_cond_broadcast(&ps->pauseCond);
+    }
+    pthread_mutex_unlock(&ps->pauseLock);
+    if (demuxSeek(ps , pts)) return 1;
+    atomic_store(&ps->pausedSeek , 0);
+    return 0;
+}
+
+//the demux thread started a seek on `serial`, 0 if it gave up on it.
+//A seek made while paused now runs until that serial's first frame is shown
+void playerSeekStarted(PlayerStatus* ps , int serial)
+{
+    int want = -1;
+    //wake the audio decode thread if it waits on the stopped callback for room in the ring
+    if (atomic_compare_exchange_strong(&ps->pausedSeek , &want , serial) && serial > 0 && ps->a_idx != DEFAULT_VALUE)
+        sem_post(&ps->pcmSpace);
+}
+
+//the first frame (or audio only, packet) of `serial` was played: a seek made while
+//paused is done, the pipeline threads park at their next playerWaitPaused()
+void playerSeekShown(PlayerStatus* ps , int serial)
+{
+    int want = serial;
+    if (serial > 0) atomic_compare_exchange_strong(&ps->pausedSeek , &want , 0);
+}
+
+//where a relative seek starts: the last target while that seek is still on its way,
+//pending or waiting for the new timeline's first clock, else the master clock
+double playerSeekBase(PlayerStatus* ps)
+{
+    double pos = playerMasterClock(ps);
+    return atomic_load(&ps->seekPending) || isnan(pos) ? ps->seekTarget : pos;
+}
+
+double playerGetSpeed(PlayerStatus* ps)
+{
+    return atomic_load(&ps->speed) / 100.0;
+}
+
+//change the playback rate without flushing anything: the external clock is
+//re-anchored where it is, video deadlines and the audio stretcher pick the
+//new rate up with their next frame
+int playerSetSpeed(PlayerStatus* ps , double rate)
+{
+    double now;
+    rate = av_clipd(rate , STRETCH_MIN_RATE , STRETCH_MAX_RATE);
+    pthread_mutex_lock(&ps->clockLock);
+    now = playerExternalClock(ps);
+    atomic_store(&ps->speed , (int)lrint(rate * 100));
+    if (!isnan(now)) playerStampWrite(&ps->extClock.stamp , now , playerClockNow(ps) , playerGetSpeed(ps) , atomic_load(&ps->serial));
+    pthread_mutex_unlock(&ps->clockLock);
+    logger(LOG , "Playback speed: %.2fx" , playerGetSpeed(ps));
+    return 1;
+}
+
+double playerGetVolume(PlayerStatus* ps)
+{
+    return atomic_load(&ps->volume) / 10.0;
+}
+
+//linear gain the audio decode thread ramps to, 0 while muted
+float playerVolumeGain(PlayerStatus* ps)
+{
+    if (atomic_load(&ps->muted)) return 0;
+    return powf(10 , (float)playerGetVolume(ps) / 20);
+}
+
+//change the volume, the audio decode thread ramps to it over DSP_RAMP
+int playerSetVolume(PlayerStatus* ps , double db)
+{
+    db = av_clipd(db , DSP_VOLUME_MIN , DSP_VOLUME_MAX);
+    atomic_store(&ps->volume , (int)lrint(db * 10));
+    logger(LOG , "Volume: %.1f dB" , playerGetVolume(ps));
+    return 1;
+}
+
+void playerToggleMute(PlayerStatus* ps)
+{
+    bool muted = !atomic_load(&ps->muted);
+    atomic_store(&ps->muted , muted);
+    logger(LOG , muted ? "Muted." : "Unmuted.");
+}
+
+//where the real samples of the track's audio stream are. The decoder already drops the
+//delay and padding the demuxer flags in side data, these bounds catch what is left:
+//output before the stream's start time, and past a duration the container itself states
+static void playerTrackBounds(Track* t)
+{
+    AVStream* st = t->fmtCtx->streams[t->idx];
+    t->time_base = st->time_base;
+    t->start = st->start_time != AV_NOPTS_VALUE ? st->start_time * av_q2d(st->time_base) : NAN;
+    t->end = NAN;
+    if (!isnan(t->start) && st->duration != AV_NOPTS_VALUE && t->fmtCtx->duration_estimation_method == AVFMT_DURATION_FROM_STREAM)
+        t->end = t->start + st->duration * av_q2d(st->time_base);
+    t->base = 0;
+}
+
+//open the decoder of the track's stream
+//return 1 on success, 0 on failure
+static int playerOpenDecoder(Track* t)
+{
+    AVCodec* codec = avcodec_find_decoder(t->fmtCtx->streams[t->idx]->codecpar->codec_id);
+    if (codec) t->codecCtx = avcodec_alloc_context3(codec);
+    if (!t->codecCtx || avcodec_parameters_to_context(t->codecCtx , t->fmtCtx->streams[t->idx]->codecpar) < 0 ||
+        avcodec_open2(t->codecCtx , codec , NULL) < 0)
+    {
+        avcodec_free_context(&t->codecCtx);
+        return 0;
+    }
+    return 1;
+}
+
+//open a playlist file's best audio stream and its decoder, every other stream is discarded.
+//Runs on the demux thread while the previous file still plays, so a bad file is skipped
+//instead of ending playback
+//return 1 on success, 0 on failure
+int playerOpenTrack(Track* t , const char* path)
+{
+    memset(t , 0 , sizeof(*t));
+    t->path = path;
+    if (avformat_open_input(&t->fmtCtx , path , NULL , NULL) == 0 && avformat_find_stream_info(t->fmtCtx , NULL) >= 0)
+        t->idx = av_find_best_stream(t->fmtCtx , AVMEDIA_TYPE_AUDIO , -1 , -1 , NULL , 0);
+    else t->idx = DEFAULT_VALUE;
+    if (t->idx < 0 || !playerOpenDecoder(t))
+    {
+        logger(LOG , "Skipping %s: no playable audio." , path);
+        playerCloseTrack(t);
+        return 0;
+    }
+    for (uint32_t i = 0; i < t->fmtCtx->nb_streams; i++)
+    {
+        if ((int)i != t->idx) t->fmtCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+    playerTrackBounds(t);
+    return 1;
+}
+
+void playerCloseTrack(Track* t)
+{
+    avcodec_free_context(&t->codecCtx);
+    avformat_close_input(&t->fmtCtx);
+}
+
+//the switch worker: find the file's next audio stream and open its decoder, off the
+//event thread since avcodec_open2() can take a while. The audio decode thread takes
+//the switch over once switchPending is set
+static void* playerSwitchPrepare(void* arg)
+{
+    PlayerStatus* ps = (PlayerStatus*)arg;
+    AVFormatContext* fmtCtx;
+    AVDictionaryEntry* lang;
+    Track* t = &ps->switchTrack;
+    int idx = DEFAULT_VALUE;
+    //the file and the playing stream are read under trackLock, the demux thread replaces them under it
+    pthread_mutex_lock(&ps->trackLock);
+    fmtCtx = ps->fmtCtx;
+    for (uint32_t i = 1; ps->a_idx != DEFAULT_VALUE && i < fmtCtx->nb_streams && idx == DEFAULT_VALUE; i++)
+    {
+        int j = (ps->track.idx + i) % fmtCtx->nb_streams;
+        if (fmtCtx->streams[j]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO && fmtCtx->streams[j]->discard != AVDISCARD_ALL) idx = j;
+    }
+    if (idx == DEFAULT_VALUE) logger(LOG , "No other audio stream.");
+    else
+    {
+        memset(t , 0 , sizeof(*t));
+        t->path = ps->track.path;
+        t->fmtCtx = fmtCtx;
+        t->idx = idx;
+        if (!playerOpenDecoder(t)) logger(LOG , "Failed to open the decoder of audio stream %d." , idx);
+        else
+        {
+            playerTrackBounds(t);
+            t->base = ps->track.base;
+            lang = av_dict_get(fmtCtx->streams[idx]->metadata , "language" , NULL , 0);
+            logger(LOG , "Switching to audio stream %d (%s), decoder ready after %.1f ms." ,
+                idx , lang ? lang->value : "und" , (playerGetTime() - ps->switchAt) * 1000);
+            atomic_store(&ps->switchPending , true);
+        }
+    }
+    pthread_mutex_unlock(&ps->trackLock);
+    atomic_store(&ps->switchPreparing , false);
+    return NULL;
+}
+
+//switch to the file's next audio stream without reopening or seeking the file. Every
+//audio stream is demuxed all along, so the queued packets of the new stream start where
+//the played ones are. Its decoder is opened on a worker thread, the audio decode thread
+//then warms it up on those packets and swaps over at a pts boundary; the event thread
+//only posts the request
+//return 1 if the switch was started, 0 otherwise
+int playerSwitchAudio(PlayerStatus* ps)
+{
+    pthread_t worker;
+    if (ps->opts.playlistLen > 0 || ps->nbMix > 0)
+    {
+        logger(LOG , "Audio stream switching is only for single files with audio, not mixed.");
+        return 0;
+    }
+    if (atomic_load(&ps->switchPending) || atomic_load(&ps->switchPreparing))
+    {
+        logger(LOG , "An audio stream switch is already under way.");
+        return 0;
+    }
+    ps->switchAt = playerGetTime();
+    atomic_store(&ps->switchPreparing , true);
+    if (pthread_create(&worker , NULL , playerSwitchPrepare , ps))
+    {
+        logger(LOG , "Failed to start the audio stream switch.");
+        atomic_store(&ps->switchPreparing , false);
+        return 0;
+    }
+    pthread_detach(worker);
+    return 1;
+}
 
+//open the file and its decoders and fill one PlayerStatus, no thread is started.
+//Every input owns one PlayerStatus, the single file player uses `player_status`.
 //return 1 on success, -1 on failure
-int playerInit(const char* c)
+int playerOpen(PlayerStatus* ps , const char* c , const PlayerOptions* opts)
 {
     if (c == NULL || c[0] == '\0') logger(EXIT_FAILURE , "Failed to get file path.");
     const char* path = c;
@@ -41,11 +409,13 @@ int playerInit(const char* c)
 
     if (avformat_open_input(&fmtCtx , path , NULL , NULL)) logger(EXIT_FAILURE , "Failed to open file.");
     if (avformat_find_stream_info(fmtCtx , NULL) < 0) logger(EXIT_FAILURE , "Failed to find stream info.");
-    av_dump_format(fmtCtx , 0 , NULL , 0);
+    av_dump_format(fmtCtx , 0 , path , 0);
 
     for (uint32_t i = 0; i < fmtCtx->nb_streams; i++)
     {
-        if (fmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        //cover art of a music file is a one picture video stream, not a video
+        if (fmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            !(fmtCtx->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC))
         {
             v_idx = i;
         }
@@ -56,63 +426,215 @@ int playerInit(const char* c)
     }
     if (v_idx == DEFAULT_VALUE) logger(LOG , "No video stream.");
     if (a_idx == DEFAULT_VALUE) logger(LOG , "No audio stream.");
+    //mixing plays the first audio stream and mixes the following ones into it
+    if (a_idx != DEFAULT_VALUE && opts->mixTracks > 0 && opts->playlistLen == 0)
+    {
+        for (uint32_t i = 0; i < fmtCtx->nb_streams; i++)
+        {
+            if (fmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+            {
+                a_idx = i;
+                break;
+            }
+        }
+    }
+    if (opts->mute) a_idx = DEFAULT_VALUE;
+    if (opts->audioOnly) v_idx = DEFAULT_VALUE;
+    if (v_idx == DEFAULT_VALUE && a_idx == DEFAULT_VALUE) logger(EXIT_FAILURE , "Nothing to play.");
+    if (v_idx == DEFAULT_VALUE) logger(LOG , "Audio only.");
     logger(LOG , "Video idx: %d, Audio idx: %d" , v_idx , a_idx);
+    //the demuxer drops packets of every other stream before they are even read into a packet.
+    //Other audio streams are kept for playerSwitchAudio(), a playlist plays one stream per file
+    for (uint32_t i = 0; i < fmtCtx->nb_streams; i++)
+    {
+        bool alternate = a_idx != DEFAULT_VALUE && opts->playlistLen == 0 &&
+            fmtCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO;
+        if ((int)i != v_idx && (int)i != a_idx && !alternate) fmtCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
 
     // get video codecCtx
-    v_codecParas = fmtCtx->streams[v_idx]->codecpar;
-    v_codec = avcodec_find_decoder(v_codecParas->codec_id);
-    if (!v_codec) logger(EXIT_FAILURE , "Failed to find decoder.");
-    v_codecCtx = avcodec_alloc_context3(v_codec);
-    if (avcodec_parameters_to_context(v_codecCtx , v_codecParas) < 0) logger(EXIT_FAILURE , "Failed.");
-    if (avcodec_open2(v_codecCtx , v_codec , NULL) < 0) logger(EXIT_FAILURE , "Failed");
+    if (v_idx != DEFAULT_VALUE)
+    {
+        v_codecParas = fmtCtx->streams[v_idx]->codecpar;
+        v_codec = avcodec_find_decoder(v_codecParas->codec_id);
+        if (!v_codec) logger(EXIT_FAILURE , "Failed to find decoder.");
+        v_codecCtx = avcodec_alloc_context3(v_codec);
+        if (avcodec_parameters_to_context(v_codecCtx , v_codecParas) < 0) logger(EXIT_FAILURE , "Failed.");
+        //let the decoder itself skip the detail a small window can't show
+        if (opts->fitWindow)
+        {
+            v_codecCtx->lowres = videoPickLowres(v_codec , v_codecParas->width , v_codecParas->height , opts->win_w , opts->win_h);
+            logger(LOG , "Video lowres: %d" , v_codecCtx->lowres);
+        }
+        if (opts->decodeThreads > 0) v_codecCtx->thread_count = opts->decodeThreads;
+        if (avcodec_open2(v_codecCtx , v_codec , NULL) < 0) logger(EXIT_FAILURE , "Failed");
+
+        AVRational frameRate = av_guess_frame_rate(fmtCtx , fmtCtx->streams[v_idx] , NULL);
+        logger(LOG , "Video Frame Rate: %d/%d\n" , frameRate.num , frameRate.den);
+    }
 
     // get audio codecCtx
-    a_codecParas = fmtCtx->streams[a_idx]->codecpar;
-    a_codec = avcodec_find_decoder(a_codecParas->codec_id);
-    if (!a_codec) logger(EXIT_FAILURE , "Failed to find decoder.");
-    a_codecCtx = avcodec_alloc_context3(a_codec);
-    if (avcodec_parameters_to_context(a_codecCtx , a_codecParas) < 0) logger(EXIT_FAILURE , "Failed.");
-    if (avcodec_open2(a_codecCtx , a_codec , NULL) < 0) logger(EXIT_FAILURE , "Failed");
-
-    AVRational frameRate = av_guess_frame_rate(fmtCtx , fmtCtx->streams[v_idx] , NULL);
-    logger(LOG , "Video Frame Rate: %d/%d\n" , frameRate.num , frameRate.den);
-    uint32_t delay = frameRate.den * 1000 / frameRate.num;
-    logger(LOG , "delay: %d\n" , delay);
-
-    //init player_status
-    player_status.isStreamFinished = false;
-    player_status.signal = false;
-    player_status.isAudioDecodeFinished = false;
-    player_status.isVideoDecodeFinished = false;
-    player_status.fmtCtx = fmtCtx;
-    player_status.a_codecCtx = a_codecCtx;
-    player_status.v_codecCtx = v_codecCtx;
-    player_status.a_codec = a_codec;
-    player_status.v_codec = v_codec;
-    player_status.a_idx = a_idx;
-    player_status.v_idx = v_idx;
-    player_status.swrCtx = NULL;
+    if (a_idx != DEFAULT_VALUE)
+    {
+        a_codecParas = fmtCtx->streams[a_idx]->codecpar;
+        a_codec = avcodec_find_decoder(a_codecParas->codec_id);
+        if (!a_codec) logger(EXIT_FAILURE , "Failed to find decoder.");
+        a_codecCtx = avcodec_alloc_context3(a_codec);
+        if (avcodec_parameters_to_context(a_codecCtx , a_codecParas) < 0) logger(EXIT_FAILURE , "Failed.");
+        if (avcodec_open2(a_codecCtx , a_codec , NULL) < 0) logger(EXIT_FAILURE , "Failed");
+    }
+
+    //the streams mixed into the playing one, in file order after it
+    ps->nbMix = 0;
+    for (uint32_t i = a_idx + 1; a_idx != DEFAULT_VALUE && i < fmtCtx->nb_streams && ps->nbMix + 1 < opts->mixTracks; i++)
+    {
+        MixTrack* m = &ps->mix[ps->nbMix];
+        if (fmtCtx->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO) continue;
+        memset(m , 0 , sizeof(*m));
+        m->track.path = path;
+        m->track.fmtCtx = fmtCtx;
+        m->track.idx = i;
+        if (!playerOpenDecoder(&m->track))
+        {
+            logger(LOG , "Failed to open the decoder of audio stream %d, it isn't mixed." , i);
+            continue;
+        }
+        playerTrackBounds(&m->track);
+        m->gain = opts->mixGain[ps->nbMix + 1];
+        m->pts = NAN;
+        ps->nbMix++;
+        logger(LOG , "Mixing audio stream %d at gain %.2f." , i , m->gain);
+    }
+    if (opts->mixTracks > ps->nbMix + 1 && a_idx != DEFAULT_VALUE)
+        logger(LOG , "Asked to mix %d audio streams, mixing %d." , opts->mixTracks , ps->nbMix + 1);
+    ps->mixBuf = NULL;
+    ps->mixBufLen = 0;
+    ps->mixHoldBuf = NULL;
+    ps->mixHoldBufLen = 0;
+
+    //init player status
+    ps->isStreamFinished = false;
+    pthread_mutex_init(&ps->demuxLock , NULL);
+    pthread_cond_init(&ps->demuxCond , NULL);
+    ps->streamDrained = false;
+    ps->signal = false;
+    ps->isAudioDecodeFinished = false;
+    ps->isVideoDecodeFinished = false;
+    ps->fmtCtx = fmtCtx;
+    ps->a_codecCtx = a_codecCtx;
+    ps->v_codecCtx = v_codecCtx;
+    ps->a_codec = a_codec;
+    ps->v_codec = v_codec;
+    ps->a_idx = a_idx;
+    ps->v_idx = v_idx;
+    ps->swrCtx = NULL;
+    ps->resample_buf = NULL;
+    ps->resample_buf_len = 0;
+    ps->opts = *opts;
+    if (ps->opts.visualize && (v_idx != DEFAULT_VALUE || a_idx == DEFAULT_VALUE))
+    {
+        logger(LOG , "The visualizer is only for audio only playback.");
+        ps->opts.visualize = false;
+    }
+    atomic_init(&ps->extClock.stamp.seq , 0);
+    atomic_init(&ps->extClock.drift , 0.0);
+    atomic_init(&ps->videoClock.stamp.seq , 0);
+    atomic_init(&ps->videoClock.drift , 0.0);
+    atomic_init(&ps->serial , 0);
+    pthread_mutex_init(&ps->pauseLock , NULL);
+    pthread_cond_init(&ps->pauseCond , NULL);
+    atomic_init(&ps->paused , false);
+    atomic_init(&ps->pausedTotal , 0.0);
+    atomic_init(&ps->pausedSeek , 0);
+    ps->wakeEvent = 0;
+    atomic_init(&ps->inputPending , false);
+    atomic_init(&ps->presentedAt , 0.0);
+    atomic_init(&ps->renderDeadline , 0.0);
+    //the audio clock needs audio, the video clock needs video
+    ps->master = opts->master;
+    if ((ps->master == SYNC_AUDIO && a_idx == DEFAULT_VALUE) || (ps->master == SYNC_VIDEO && v_idx == DEFAULT_VALUE))
+        ps->master = SYNC_EXTERNAL;
+    logger(LOG , "Sync master: %s clock." , ps->master == SYNC_AUDIO ? "audio" : ps->master == SYNC_VIDEO ? "video" : "external");
+    pthread_mutex_init(&ps->clockLock , NULL);
+    atomic_init(&ps->speed , (int)lrint(av_clipd(opts->speed > 0 ? opts->speed : 1.0 , STRETCH_MIN_RATE , STRETCH_MAX_RATE) * 100));
+    atomic_init(&ps->volume , (int)lrint(av_clipd(opts->volume , DSP_VOLUME_MIN , DSP_VOLUME_MAX) * 10));
+    atomic_init(&ps->muted , false);
+    memset(&ps->vstats , 0 , sizeof(ps->vstats));
+    //the file is track 0 of the playlist, its bounds start the trims
+    memset(&ps->track , 0 , sizeof(ps->track));
+    ps->track.path = path;
+    ps->track.fmtCtx = fmtCtx;
+    ps->track.codecCtx = a_codecCtx;
+    ps->track.idx = a_idx;
+    ps->trimStart = ps->trimEnd = NAN;
+    if (a_idx != DEFAULT_VALUE)
+    {
+        playerTrackBounds(&ps->track);
+        ps->trimStart = ps->track.start;
+        ps->trimEnd = ps->track.end;
+    }
+    atomic_init(&ps->trackPlaying , 0);
+    pthread_mutex_init(&ps->trackLock , NULL);
+    pthread_cond_init(&ps->trackCond , NULL);
+    atomic_init(&ps->seekPending , false);
+    ps->seekTarget = 0;
+    atomic_init(&ps->seekReport , false);
+    ps->seekDropped = 0;
+    ps->audioSerial = 0;
+    atomic_init(&ps->pcmFlush , 0);
+    atomic_init(&ps->switchPreparing , false);
+    atomic_init(&ps->switchPending , false);
+    ps->switchWarmed = 0;
 
 
     //init queue
-    Queue* vpq = &player_status.vpq;
-    Queue* apq = &player_status.apq;
-    Queue* vfq = &player_status.vfq;
-    Queue* afq = &player_status.afq;
-
-    if (!init(AVPACKET , vpq)) logger(EXIT_FAILURE , "Failed to initilize video packet queue.");
-    if (!init(AVPACKET , apq)) logger(EXIT_FAILURE , "Failed to initilize audio packet queue.");
-    if (!init(AVFRAME , vfq)) logger(EXIT_FAILURE , "Failed to initilize video frame queue.");
-    if (!init(AVFRAME , afq)) logger(EXIT_FAILURE , "Failed to initilize audio frame queue.");
-
-    //init SDL subsystem
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) logger(EXIT_FAILURE , "Failed to init SDL subsystem.");
+    Queue* vpq = &ps->vpq;
+    Queue* apq = &ps->apq;
+    Queue* vfq = &ps->vfq;
+    Queue* afq = &ps->afq;
+
+    if (!init(AVPACKET , vpq , &ps->isStreamFinished)) logger(EXIT_FAILURE , "Failed to initilize video packet queue.");
+    if (!init(AVPACKET , apq , &ps->isStreamFinished)) logger(EXIT_FAILURE , "Failed to initilize audio packet queue.");
+    if (!init(AVFRAME , vfq , &ps->isVideoDecodeFinished)) logger(EXIT_FAILURE , "Failed to initilize video frame queue.");
+    if (!init(AVFRAME , afq , &ps->isAudioDecodeFinished)) logger(EXIT_FAILURE , "Failed to initilize audio frame queue.");
+    if (!packetPoolInit(&ps->pktPool)) logger(EXIT_FAILURE , "Failed to initilize packet pool.");
+
+    res = 1;
+    return res;
+}
+
+//create demux thread, audio thread and video threads
+//return 1 on success, -1 on failure
+int playerInit(const char* c , const PlayerOptions* opts)
+{
+    int res = DEFAULT_VALUE;
+
+    playerOpen(&player_status , c , opts);
+
+    //init SDL subsystem, audio only needs no video subsystem, only its events.
+    //Without a window SDL would only poll for them, so the event loop waits on wakeCond
+    //and SDL leaves SIGINT and SIGTERM to their default action, nothing would pump its SDL_QUIT
+    player_status.windowless = player_status.v_idx == DEFAULT_VALUE && !player_status.opts.visualize;
+    pthread_mutex_init(&player_status.wakeLock , NULL);
+    pthread_cond_init(&player_status.wakeCond , NULL);
+    player_status.wakePending = 0;
+    if (player_status.windowless) SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS , "1");
+    if (SDL_Init((player_status.windowless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) | SDL_INIT_AUDIO | SDL_INIT_TIMER))
+        logger(EXIT_FAILURE , "Failed to init SDL subsystem.");
+    //the pipeline wakes the event loop with these
+    player_status.wakeEvent = SDL_RegisterEvents(1);
+    if (player_status.wakeEvent == (Uint32)-1)
+    {
+        logger(LOG , "Failed to register the wake up event.");
+        player_status.wakeEvent = 0;
+    }
     //open demux thread
     openDemux(&player_status);
     //open audio thread
-    openAudio(&player_status);
+    if (player_status.a_idx != DEFAULT_VALUE) openAudio(&player_status);
     //open vidoe thread
-    openVideo(&player_status);
+    if (player_status.v_idx != DEFAULT_VALUE) openVideo(&player_status);
+    else if (player_status.opts.visualize) openVisualizer(&player_status);
 
     res = 1;
     return res;
@@ -122,31 +644,188 @@ int playerDeinit()
 
 }
 
-int playerPause()
+//pause or resume. Paused, the SDL device stops, the clocks freeze and every pipeline thread
+//parks on pauseCond at its next playerWaitPaused() or blocks on a full queue; the queues,
+//the PCM ring and the decoders keep their contents, so resuming plays on from them at once
+//return 1 if the state changed, 0 if it already was that
+int playerSetPaused(PlayerStatus* ps , bool paused)
 {
+    double dt;
+    if (atomic_load(&ps->paused) == paused) return 0;
+    if (paused)
+    {
+        //the device is paused under the lock, so a reopen in between can't restart it
+        pthread_mutex_lock(&ps->pauseLock);
+        if (ps->a_idx != DEFAULT_VALUE) SDL_PauseAudio(1);
+        ps->pausedAt = playerGetTime();
+        atomic_store(&ps->paused , true);
+        pthread_mutex_unlock(&ps->pauseLock);
+        logger(LOG , "Paused at %.3f s." , playerMasterClock(ps));
+        return 1;
+    }
+    //the external clock under its lock, the audio clock while the callback is stopped,
+    //the video clock by the render thread when it sees pausedTotal change
+    dt = playerGetTime() - ps->pausedAt;
+    pthread_mutex_lock(&ps->clockLock);
+    playerClockShift(&ps->extClock , dt);
+    pthread_mutex_unlock(&ps->clockLock);
+    playerClockShift(&ps->audioClock , dt);
+    atomic_store(&ps->pausedTotal , atomic_load(&ps->pausedTotal) + dt);
+    pthread_mutex_lock(&ps->pauseLock);
+    atomic_store(&ps->paused , false);
+    atomic_store(&ps->pausedSeek , 0);
+    pthread_cond_broadcast(&ps->pauseCond);
+    if (ps->a_idx != DEFAULT_VALUE) SDL_PauseAudio(0);
+    pthread_mutex_unlock(&ps->pauseLock);
+    logger(LOG , "Resumed at %.3f s after %.1f s paused." , playerMasterClock(ps) , dt);
     return 1;
 }
+
+//park the calling thread while the player is paused, unless a seek made while paused
+//still has to show its frame
+//return 1 if it was parked, 0 if it went straight on
+int playerWaitPaused(PlayerStatus* ps)
+{
+    int parked = 0;
+    if (!atomic_load(&ps->paused) || atomic_load(&ps->pausedSeek)) return 0;
+    pthread_mutex_lock(&ps->pauseLock);
+    while (atomic_load(&ps->paused) && !atomic_load(&ps->pausedSeek))
+    {
+        parked = 1;
+        pthread_cond_wait(&ps->pauseCond , &ps->pauseLock);
+    }
+    pthread_mutex_unlock(&ps->pauseLock);
+    return parked;
+}
+
+int playerPause()
+{
+    return playerSetPaused(&player_status , !atomic_load(&player_status.paused));
+}
 int playerExit()
 {
     return 1;
 }
 
-int playerRun(const char* c)
+//wake the event loop from a pipeline thread, never from the audio callback
+void playerWake(PlayerStatus* ps , int code)
+{
+    SDL_Event event;
+    if (!ps->wakeEvent) return;
+    if (ps->windowless)
+    {
+        pthread_mutex_lock(&ps->wakeLock);
+        ps->wakePending |= 1 << code;
+        pthread_cond_signal(&ps->wakeCond);
+        pthread_mutex_unlock(&ps->wakeLock);
+        return;
+    }
+    memset(&event , 0 , sizeof(event));
+    event.type = ps->wakeEvent;
+    event.user.code = code;
+    SDL_PushEvent(&event);
+}
+
+//act on a key
+//return 1 if its action shows with the next frame, to measure the input latency up to it
+static int playerHandleKey(PlayerStatus* ps , const SDL_KeyboardEvent* key)
+{
+    int sym = key->keysym.sym;
+    if (sym == SDLK_SPACE)
+    {
+        playerPause();
+        //a resume shows with the next frame, a pause is done once the call returns
+        return !atomic_load(&ps->paused);
+    }
+    else if (sym == SDLK_RIGHTBRACKET)
+    {
+        playerSetSpeed(ps , playerGetSpeed(ps) + 0.25);
+    }
+    else if (sym == SDLK_LEFTBRACKET)
+    {
+        playerSetSpeed(ps , playerGetSpeed(ps) - 0.25);
+    }
+    else if (sym == SDLK_BACKSLASH)
+    {
+        playerSetSpeed(ps , 1.0);
+    }
+    else if (sym == SDLK_UP || sym == SDLK_DOWN)
+    {
+        playerSetVolume(ps , playerGetVolume(ps) + (sym == SDLK_UP ? PLAYER_VOLUME_STEP : -PLAYER_VOLUME_STEP));
+    }
+    else if (sym == SDLK_m)
+    {
+        playerToggleMute(ps);
+    }
+    else if (sym == SDLK_a)
+    {
+        playerSwitchAudio(ps);
+    }
+    else if (sym == SDLK_LEFT || sym == SDLK_RIGHT)
+    {
+        //shift lands on the exact frame instead of the nearest keyframe; paused, the frame is still shown
+        return playerSeek(ps , playerSeekBase(ps) + (sym == SDLK_RIGHT ? PLAYER_SEEK_STEP : -PLAYER_SEEK_STEP) ,
+            key->keysym.mod & KMOD_SHIFT ? PLAYER_SEEK_ACCURATE : PLAYER_SEEK_FAST);
+    }
+    return 0;
+}
+
+//how long the event loop may sleep, in ms: with a key waiting for its frame, until the
+//render thread's current deadline (the present wakes the loop earlier), otherwise until an event
+static int playerEventTimeout(PlayerStatus* ps)
+{
+    double wait;
+    if (!atomic_load(&ps->inputPending)) return -1;
+    wait = atomic_load(&ps->renderDeadline) - playerGetTime();
+    return (int)FFMAX(wait * 1000 , 0) + PLAYER_EVENT_SLACK;
+}
+
+//main thread: sleep in SDL until an event comes, a key, a window change or a pipeline thread's
+//wake up, so a key is acted on as soon as it is pressed and an idle or paused player costs nothing.
+//The input latency of every key is logged: the time up to the frame showing its action for
+//seeks and resumes in a video, up to the action's return otherwise
+//the event loop's wait without a window: sleep on wakeCond until a pipeline thread
+//wakes it, then hand the wake over as the user event SDL would have delivered
+//return 1, there is always an event
+static int playerWaitWake(PlayerStatus* ps , SDL_Event* event)
+{
+    int code = 0;
+    pthread_mutex_lock(&ps->wakeLock);
+    while (!ps->wakePending) pthread_cond_wait(&ps->wakeCond , &ps->wakeLock);
+    while (!(ps->wakePending & (1 << code))) code++;
+    ps->wakePending &= ~(1 << code);
+    pthread_mutex_unlock(&ps->wakeLock);
+    memset(event , 0 , sizeof(*event));
+    event->type = ps->wakeEvent;
+    event->user.code = code;
+    return 1;
+}
+
+int playerRun(const char* c , const PlayerOptions* opts)
 {
+    PlayerStatus* ps = &player_status;
+    SDL_Event event;
+    bool running = true;
+    double pressed;
+    int timeout , got , serial;
     if (c == NULL || c[0] == '\0') logger(EXIT_FAILURE , "Failed to get file path.");
     const char* path = c;
 
-    playerInit(path);
+    playerInit(path , opts);
 
     //handle events
-    SDL_Event event;
-    while (1)
+    while (running)
     {
-        SDL_PumpEvents();
-        while (!SDL_PollEvent(&event))//have event
+        timeout = playerEventTimeout(ps);
+        if (ps->windowless) got = playerWaitWake(ps , &event);
+        else got = timeout < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event , timeout);
+        if (!got)
         {
-            av_usleep(1000000);
-            SDL_PumpEvents();
+            //the frame didn't come, the key's latency can't be measured
+            if (atomic_load(&ps->inputPending) && playerGetTime() - ps->inputAt > PLAYER_INPUT_TIMEOUT &&
+                atomic_exchange(&ps->inputPending , false))
+                logger(LOG , "Input latency: no frame within %.1f s." , PLAYER_INPUT_TIMEOUT);
+            continue;
         }
         switch (event.type)
         {
@@ -155,19 +834,42 @@ int playerRun(const char* c)
             if (event.key.keysym.sym == SDLK_ESCAPE)
             {
                 playerExit();
+                running = false;
                 break;
             }
-            else if (event.key.keysym.sym == SDLK_SPACE)
+            //SDL stamps the key in ms since its init, the time it waited in SDL's queue counts too
+            pressed = playerGetTime() - (double)(SDL_GetTicks() - event.key.timestamp) / 1000;
+            //the timeline before the key: a seek may start a new one before playerHandleKey() returns
+            serial = atomic_load(&ps->serial);
+            if (playerHandleKey(ps , &event.key) && ps->v_idx != DEFAULT_VALUE)
             {
-                playerPause();
+                ps->inputAt = pressed;
+                ps->inputSerial = event.key.keysym.sym == SDLK_SPACE ? -1 : serial;
+                atomic_store(&ps->inputPending , true);
             }
+            else logger(LOG , "Input latency: %.1f ms to act." , (playerGetTime() - pressed) * 1000);
+            break;
         }
         case SDL_WINDOWEVENT:
         {
 
             break;
         }
-        default:break;
+        case SDL_QUIT:
+        {
+            playerExit();
+            running = false;
+            break;
+        }
+        default:
+        {
+            if (!ps->wakeEvent || event.type != ps->wakeEvent) break;
+            if (event.user.code == PLAYER_WAKE_FRAME)
+                logger(LOG , "Input latency: %.1f ms to the frame." , (atomic_load(&ps->presentedAt) - ps->inputAt) * 1000);
+            else if (event.user.code == PLAYER_WAKE_END)
+                logger(LOG , "Playback finished.");
+            break;
+        }
         }
 
     }
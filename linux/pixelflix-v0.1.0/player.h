@@ -1,11 +1,31 @@
 #ifndef PLAYER_H__
 #define PLAYER_H__
 #include "queue.h"
+#include "ring.h"
+#include "convert.h"
+#include "stretch.h"
+#include "spectrum.h"
+#include "mix.h"
+#include "loudness.h"
+#include "dsp.h"
 #include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libswresample/swresample.h>
 #define DEFAULT_VALUE -1
+//control packets the demux thread queues among the audio packets, told apart by stream_index
+#define PACKET_SEEK -2 //the demuxer seeked, pts is the target in microseconds of playlist time, pos the new serial
+#define PACKET_TRACK -3 //the next playlist file starts here, see nextTrack
+#define PLAYER_SEEK_STEP 10.0 //seconds the arrow keys seek by
+#define PLAYER_SEEK_FAST 0 //land on the keyframe nearest the target, nothing is decoded ahead of it
+#define PLAYER_SEEK_ACCURATE 1 //land on the target's frame: decode from the keyframe before it, drop what precedes it
+#define PLAYER_VOLUME_STEP 2.0 //dB the up and down keys change the volume by
+#define PLAYER_EVENT_SLACK 5 //ms the event loop waits past a frame deadline for the frame a key is waiting for
+#define PLAYER_INPUT_TIMEOUT 2.0 //seconds a key waits for its frame before its latency is given up on
+#define PLAYER_WAKE_FRAME 1 //wake event: the frame a key was waiting for was presented
+#define PLAYER_WAKE_END 2 //wake event: a stream played to its end
 
 typedef struct FF_AudioParas
 {
@@ -18,6 +38,138 @@ typedef struct FF_AudioParas
 
 }FFAudioParas;
 
+//the clock the others follow, see playerMasterClock()
+typedef enum SyncMaster
+{
+    SYNC_AUDIO ,//the device plays at its own pace, video follows the audio clock
+    SYNC_EXTERNAL ,//the monotonic clock, audio is resampled onto it; files without audio use it
+    SYNC_VIDEO ,//frames are shown on their own timing and audio follows them, for debugging
+}SyncMaster;
+
+typedef struct PlayerOptions
+{
+    int win_w;//window(tile) width, 0 means the video's own width
+    int win_h;//window(tile) height, 0 means the video's own height
+    bool fitWindow;//decode and convert at the window size instead of the coded size
+    bool mute;//don't open the audio stream
+    bool audioOnly;//don't open the video stream, no window, no video threads
+    bool visualize;//spectrum analyzer window for audio only playback
+    bool dither;//TPDF dither when audio is reduced to 16 bit
+    double audioLatency;//extra output latency past SDL's buffers (HDMI, bluetooth), seconds
+    SyncMaster master;//clock the others follow, SYNC_AUDIO falls back to SYNC_EXTERNAL without audio
+    double speed;//initial playback rate, 0 means 1
+    int decodeThreads;//video decoder threads, 0 means the codec default
+    int poolThreads;//mosaic worker pool size, 0 means one per cpu
+    const char** playlist;//files played after this one without a gap, audio only
+    int playlistLen;
+    int mixTracks;//mix the file's first mixTracks audio streams, 0 plays one stream
+    float mixGain[MIX_MAX_TRACKS];//gain of each mixed stream, in file order
+    bool normalize;//scale each file's audio to loudnessTarget
+    double loudnessTarget;//integrated loudness, LUFS
+    double volume;//initial volume, dB
+    DspBand eq[DSP_MAX_BANDS];//equalizer, peaking bands
+    int eqBands;
+}PlayerOptions;
+
+//the audio stream of one playlist file, as the audio decode thread plays it.
+//Samples outside [start, end) are encoder delay and padding and are trimmed
+typedef struct Track
+{
+    const char* path;
+    AVFormatContext* fmtCtx;//owned by the demux thread
+    AVCodecContext* codecCtx;//owned by the audio decode thread
+    int idx;//audio stream
+    AVRational time_base;
+    double start;//stream pts of the first real sample, NAN if unknown
+    double end;//stream pts past the last real sample, NAN if the container doesn't state it
+    double base;//playlist time of stream pts 0, tracks follow each other on one timeline
+}Track;
+
+//an audio stream mixed into the playing one, decoded on the audio decode thread
+typedef struct MixTrack
+{
+    Track track;
+    float gain;
+    struct SwrContext* swrCtx;//to the device format
+    Ring fifo;//converted PCM not mixed yet
+    double pts;//playlist time at the fifo's read position
+    uint8_t* buf;//conversion output, then mixer input
+    unsigned int buf_len;
+    uint64_t underruns;//frames of the playing stream it had too little PCM for
+}MixTrack;
+
+//a pts, the monotonic time (or PCM byte position) it belongs to and the playback
+//rate from there on, published with a seqlock: the single writer never blocks,
+//a reader retries if it raced the writer
+typedef struct ClockStamp
+{
+    atomic_uint seq;//odd while being written, 0 until the first write
+    double pts;
+    double at;
+    double rate;
+    int serial;//timeline the pts is on, see PlayerStatus.serial
+}ClockStamp;
+
+//one clock of the sync engine: a stamp extrapolated at the playback rate and how far it
+//was from the master when last written. A clock whose serial is behind the player's is stale
+typedef struct SyncClock
+{
+    ClockStamp stamp;
+    _Atomic double drift;//this clock minus the master, seconds, 0 for the master itself
+}SyncClock;
+
+//audio clock vs master clock drift, averaged and turned into a small speed change
+typedef struct AudioDrift
+{
+    double cum;//exponentially weighted sum of the clock difference
+    double coef;
+    int count;//differences seen since the last reset
+    double ratio;//smoothed speed change, positive stretches the audio
+    double carry;//fraction of a sample not applied yet
+}AudioDrift;
+
+#define AUDIO_STATS_BUCKETS 8
+
+//SDL audio callback health, written by the callback only, read by the stats report
+typedef struct AudioStats
+{
+    atomic_ullong calls;
+    atomic_ullong underruns;//the ring ran dry while the stream was still playing
+    atomic_ullong silences;//calls that padded the buffer with silence, for any reason
+    atomic_ullong overruns;//calls that took longer than their buffer lasts
+    atomic_ullong max_ns;//longest call
+    atomic_ullong hist[AUDIO_STATS_BUCKETS];//time per call as a share of the buffer duration
+    double budget;//duration of one device buffer, seconds
+}AudioStats;
+
+//device buffer and PCM ring depth, adapted by the audio decode thread to the underruns seen
+typedef struct AudioAdapt
+{
+    int samples;//device buffer, in sample frames
+    int depth;//PCM ring fill limit, in device buffers
+    size_t limit;//the same in bytes
+    uint64_t underruns;//callback underruns at the last check
+    double since;//time of the last change
+    double stable;//seconds without underruns before shrinking
+    bool shrunk;//the last change was a shrink
+    double checked;
+    double paused;//pausedTotal at the last check, time spent paused isn't stable time
+}AudioAdapt;
+
+//per frame presentation timing, measured by the video render thread
+typedef struct FrameStats
+{
+    uint64_t presented;
+    uint64_t dropped;//too late to show and a newer frame was waiting
+    double lateness;//last frame: present time minus deadline, seconds
+    double jitter;//last frame: lateness change against the previous frame
+    double max_lateness;
+    double sum_jitter;//sum of |jitter|, for the mean
+    double syncError;//last frame: its pts minus the master clock when it was presented
+    double max_syncError;//largest |syncError|
+    double sum_syncError;//sum of |syncError|, for the mean
+}FrameStats;
+
 typedef struct PlayerStatus
 {
     bool isStreamFinished;
@@ -39,13 +191,126 @@ typedef struct PlayerStatus
     Queue afq;//audio frame queue
     FFAudioParas srcParas;
     FFAudioParas tgtParas;
+    uint8_t* resample_buf;
+    unsigned int resample_buf_len;
+    Converter conv;//fixed-rate format conversion and downmix
+    Ring pcm;//converted PCM from the audio decode thread to the SDL callback
+    sem_t pcmSpace;//posted by the callback after it consumed from pcm
+    double audioNextPts;//pts right after the last decoded audio frame
+    ClockStamp pcmMark;//pts at the ring's write position, by the audio decode thread
+    SyncClock audioClock;//pts audible at a monotonic time, by the SDL callback
+    AudioDrift drift;
+    Stretch stretch;//time stretch for playback rates other than 1
+    atomic_int speed;//playback rate in percent
+    Spectrum spectrum;//analyzer tap, only fed with opts.visualize
+    PacketPool pktPool;
+    PlayerOptions opts;
+    //external clock: pts at a monotonic time, advancing at the playback rate
+    SyncClock extClock;
+    pthread_mutex_t clockLock;//serializes the external clock's writers
+    SyncClock videoClock;//pts on screen at a monotonic time, by the video render thread
+    SyncMaster master;
+    atomic_int serial;//current timeline, a new one starts when the master clock is re-anchored
+    //pause: the pipeline threads park on pauseCond, the clocks read as of pausedAt
+    pthread_mutex_t pauseLock;
+    pthread_cond_t pauseCond;
+    atomic_bool paused;
+    double pausedAt;//published by paused
+    _Atomic double pausedTotal;//seconds spent paused, each clock's writer shifts its stamp by what it hasn't seen
+    atomic_int pausedSeek;//a seek made while paused runs the pipeline: -1 until the demux thread starts it, then the serial whose first shown frame ends it, 0 for none
+    //event loop, see playerRun(): the pipeline threads wake it with wakeEvent user events
+    Uint32 wakeEvent;//0 if none could be registered
+    //without a window there are no SDL events to wait for, the loop waits on wakeCond instead
+    bool windowless;
+    pthread_mutex_t wakeLock;
+    pthread_cond_t wakeCond;
+    int wakePending;//1 << code of every wake not handled yet, under wakeLock
+    atomic_bool inputPending;//a key's action shows with the next presented frame of a serial other than inputSerial
+    int inputSerial;//published by inputPending, -1 means any frame
+    double inputAt;//when the key was pressed
+    _Atomic double presentedAt;//last present, by the render thread
+    _Atomic double renderDeadline;//deadline of the frame being prepared, by the render thread
+    FrameStats vstats;
+    AudioStats astats;
+    AudioAdapt adapt;
+    //seeking and gapless playlists: the demux thread reads and seeks, the audio decode thread trims
+    Track track;//the track the audio decode thread plays
+    Track nextTrack;//opened by the demux thread, taken over at its PACKET_TRACK
+    atomic_int trackPlaying;//playlist position of `track`
+    pthread_mutex_t trackLock;//held to replace fmtCtx and a_idx, or to read them off the demux thread
+    pthread_cond_t trackCond;//signaled when trackPlaying advances
+    atomic_bool seekPending;
+    pthread_mutex_t demuxLock;//held to set or clear isStreamFinished once the demux thread started
+    pthread_cond_t demuxCond;//the demux thread waits on it at the end of the stream, until a seek
+    bool streamDrained;//a decoder drains for good, the stream can't be seeked any more
+    double seekTarget;//playlist time, published by seekPending
+    int seekFlags;//PLAYER_SEEK_*, published by seekPending
+    double seekAt;//when the last seek was asked for
+    atomic_bool seekReport;//the last seek's latency is still to be logged, by the first stage to play it
+    uint64_t seekDropped;//video frames decoded and dropped to reach the last target
+    int audioSerial;//serial of the PCM the audio decode thread writes, from the seek markers
+    double trimStart;//audio before this playlist time is dropped: encoder delay, a seek's lead-in
+    double trimEnd;//audio from this playlist time on is dropped: encoder padding
+    atomic_size_t pcmFlush;//ring position a seek discards up to, the callback skips there
+    //audio stream switching, see playerSwitchAudio()
+    Track switchTrack;//the stream being switched to, its decoder opened by the switch worker
+    atomic_bool switchPreparing;//the switch worker is opening switchTrack's decoder
+    atomic_bool switchPending;//switchTrack is set, cleared by the audio decode thread once it swapped
+    int switchWarmed;//frames the new decoder produced, on the audio decode thread
+    double switchAt;//when the switch was asked for
+    //multi-stream mixing, see opts.mixTracks: the playing stream is mixed with these
+    MixTrack mix[MIX_MAX_TRACKS - 1];
+    int nbMix;
+    uint8_t* mixBuf;//the mixed frame
+    unsigned int mixBufLen;
+    Ring mixHold;//PCM of the playing stream waiting for the mixed streams' PCM
+    double mixHoldPts;//playlist time at mixHold's read position
+    uint8_t* mixHoldBuf;//PCM taken out of mixHold, mixer input
+    unsigned int mixHoldBufLen;
+    //loudness normalization, see opts.normalize, on the audio decode thread
+    Loudness loud;
+    //volume and equalizer, see playerSetVolume()
+    Dsp dsp;//on the audio decode thread
+    bool dspReady;//dsp is set up for the device format
+    atomic_int volume;//tenths of a dB
+    atomic_bool muted;
 
 }PlayerStatus;
 
 extern PlayerStatus player_status;
 
-int playerInit(const char* c);
-int playerRun(const char* c);
+int playerOpen(PlayerStatus* ps , const char* c , const PlayerOptions* opts);
+int playerInit(const char* c , const PlayerOptions* opts);
+int playerRun(const char* c , const PlayerOptions* opts);
+double playerGetTime(void);
+double playerClockGet(PlayerStatus* ps , SyncClock* c);
+void playerClockSet(PlayerStatus* ps , SyncClock* c , double pts , double at , double rate , int serial);
+double playerExternalClock(PlayerStatus* ps);
+double playerVideoClock(PlayerStatus* ps);
+double playerMasterClock(PlayerStatus* ps);
+int playerSetMasterClock(PlayerStatus* ps , double pts);
+int playerResetClocks(PlayerStatus* ps);
+double playerClockNow(PlayerStatus* ps);
+void playerClockShift(SyncClock* c , double dt);
+int playerSetPaused(PlayerStatus* ps , bool paused);
+int playerWaitPaused(PlayerStatus* ps);
+void playerWake(PlayerStatus* ps , int code);
+int playerSeek(PlayerStatus* ps , double pts , int flags);
+void playerSeekStarted(PlayerStatus* ps , int serial);
+void playerSeekShown(PlayerStatus* ps , int serial);
+double playerSeekBase(PlayerStatus* ps);
+int playerStartClock(PlayerStatus* ps , double pts);
+double playerGetSpeed(PlayerStatus* ps);
+int playerSetSpeed(PlayerStatus* ps , double rate);
+void playerStampWrite(ClockStamp* st , double pts , double at , double rate , int serial);
+int playerStampRead(ClockStamp* st , double* pts , double* at , double* rate , int* serial);
+int playerOpenTrack(Track* t , const char* path);
+void playerCloseTrack(Track* t);
+int playerSwitchAudio(PlayerStatus* ps);
+int playerSetVolume(PlayerStatus* ps , double db);
+double playerGetVolume(PlayerStatus* ps);
+float playerVolumeGain(PlayerStatus* ps);
+void playerToggleMute(PlayerStatus* ps);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,105 @@
+#include "pool.h"
+#include "logger.h"
+#include <stdlib.h>
+
+static void* poolWorker(void* arg)
+{
+    Pool* pool = (Pool*)arg;
+    PoolJob* job;
+    while (1)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->head && !pool->quit)
+        {
+            pthread_cond_wait(&pool->cond , &pool->mutex);
+        }
+        if (!pool->head)//quit and nothing left
+        {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) pool->rear = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+
+        job->task(job->arg);
+        free(job);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->pending == 0) pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return NULL;
+}
+
+//1 on success, 0 on failure
+int poolInit(Pool* pool , int nb_workers)
+{
+    if (nb_workers < 1) nb_workers = 1;
+    pool->head = NULL;
+    pool->rear = NULL;
+    pool->pending = 0;
+    pool->quit = false;
+    pthread_mutex_init(&pool->mutex , NULL);
+    pthread_cond_init(&pool->cond , NULL);
+    pthread_cond_init(&pool->idle , NULL);
+    pool->workers = (pthread_t*)malloc(sizeof(pthread_t) * nb_workers);
+    if (!pool->workers) return 0;
+    for (pool->nb_workers = 0; pool->nb_workers < nb_workers; pool->nb_workers++)
+    {
+        if (pthread_create(&pool->workers[pool->nb_workers] , NULL , poolWorker , pool)) break;
+    }
+    logger(LOG , "Pool started %d workers." , pool->nb_workers);
+    return pool->nb_workers > 0;
+}
+
+//1 on success, 0 on failure
+int poolSubmit(Pool* pool , PoolTask task , void* arg)
+{
+    PoolJob* job = (PoolJob*)malloc(sizeof(PoolJob));
+    if (!job) return 0;
+    job->task = task;
+    job->arg = arg;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->rear) pool->rear->next = job;
+    else pool->head = job;
+    pool->rear = job;
+    pool->pending++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return 1;
+}
+
+//block until every submitted job has finished
+int poolWait(Pool* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->idle , &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 1;
+}
+
+//run the remaining jobs, then join the workers
+int poolDestroy(Pool* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < pool->nb_workers; i++)
+    {
+        pthread_join(pool->workers[i] , NULL);
+    }
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->nb_workers = 0;
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+    pthread_cond_destroy(&pool->idle);
+    return 1;
+}
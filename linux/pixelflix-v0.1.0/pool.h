@@ -0,0 +1,35 @@
+#ifndef POOL_H__
+#define POOL_H__
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*PoolTask)(void* arg);
+
+typedef struct PoolJob
+{
+    PoolTask task;
+    void* arg;
+    struct PoolJob* next;
+}PoolJob;
+
+//a fixed number of worker threads shared by every input,
+//jobs run in submit order on whichever worker is free
+typedef struct Pool
+{
+    pthread_t* workers;
+    int nb_workers;
+    PoolJob* head;
+    PoolJob* rear;
+    int pending;//jobs queued or running
+    bool quit;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;//signaled when a job is queued or on quit
+    pthread_cond_t idle;//signaled when pending drops to 0
+}Pool;
+
+int poolInit(Pool* pool , int nb_workers);
+int poolSubmit(Pool* pool , PoolTask task , void* arg);
+int poolWait(Pool* pool);
+int poolDestroy(Pool* pool);
+
+#endif
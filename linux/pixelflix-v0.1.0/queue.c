@@ -20,13 +20,21 @@ int destroy(Queue* q)
 {
     if (!q->head) return 0;
     Node* temp = q->head;
-    while (!temp)
+    while (temp)
+    {
+        Node* next = temp->next;
+        free(temp);
+        temp = next;
+    }
+    temp = q->spare;
+    while (temp)
     {
         Node* next = temp->next;
         free(temp);
         temp = next;
     }
     q->head = NULL;
+    q->spare = NULL;
     q->n = 0;
     q->bytes = 0;
     return 1;
@@ -37,9 +45,20 @@ int enqueue(Queue* q , void* elem)
 {
     SDL_LockMutex(q->mutex);
     if (q == NULL || elem == NULL) logger(EXIT_FAILURE , "NULL pointer error");
-    if (av_packet_make_refcounted(elem)) logger(LOG , "Failed to set elem reference counted.");
-    if (isFull(q)) return 0;
-    Node* pnode = (Node*)av_malloc(sizeof(Node));
+    if (q->type == AVPACKET && av_packet_make_refcounted(elem)) logger(LOG , "Failed to set elem reference counted.");
+    //a full queue makes the producer wait for the consumer, unless the queue is blocked
+    while (isFull(q) && !q->blocked)
+    {
+        SDL_CondWait(q->cond , q->mutex);
+    }
+    if (isFull(q))
+    {
+        SDL_UnlockMutex(q->mutex);
+        return 0;
+    }
+    Node* pnode = q->spare;
+    if (pnode) q->spare = pnode->next;
+    else pnode = (Node*)av_malloc(sizeof(Node));
     if (!pnode) logger(EXIT_FAILURE , "Failed to malloc Node.");
     pnode->e = elem;
     pnode->next = NULL;
@@ -48,8 +67,7 @@ int enqueue(Queue* q , void* elem)
     q->n++;
     if (q->type == AVPACKET) q->bytes += sizeof(AVPacket);
     else if (q->type == AVFRAME) q->bytes += sizeof(AVFrame);
-    player_status.signal = true;
-    SDL_CondSignal(q->cond);
+    SDL_CondBroadcast(q->cond);
     if (q->type == AVPACKET)
         logger(LOG , "[%d]en: n=%d, size=%d, last_data=%x" , q->type , q->n , q->bytes , ((AVPacket*)(q->rear->e))->data);
     else if (q->type == AVFRAME)
@@ -70,15 +88,19 @@ int dequeue(Queue* q , void** elem)
         temp = q->head->next;
         if (temp != NULL)// n>0
         {
-            if (q->type == AVPACKET) *elem = temp->e;
+            *elem = temp->e;
             q->head->next = q->head->next->next;
             temp->next = NULL;
             if (temp == q->rear) q->rear = q->head;//if n=1, q->rear should be q->head after dequeue.
             if (q->type == AVPACKET) q->bytes -= sizeof(AVPacket);
             else if (q->type == AVFRAME) q->bytes -= sizeof(AVFrame);
             q->n--;
-            free(temp);
-            if (q->type == AVPACKET)
+            temp->next = q->spare;
+            q->spare = temp;
+            if (q->n + 1 == q->max) SDL_CondBroadcast(q->cond);//a producer may wait for room
+            if (q->head->next == NULL)
+                logger(LOG , "[%d]de: n=%d, size=%d" , q->type , q->n , q->bytes);
+            else if (q->type == AVPACKET)
                 logger(LOG , "[%d]de: n=%d, size=%d, first_data=%x" , q->type , q->n , q->bytes , ((AVPacket*)(q->head->next->e))->data);
             else if (q->type == AVFRAME)
                 logger(LOG , "[%d]de: n=%d, size=%d, first_data=%lx" , q->type , q->n , q->bytes , ((AVFrame*)(q->head->next->e))->data);
@@ -86,24 +108,79 @@ int dequeue(Queue* q , void** elem)
             res = 1;
             break;
         }
-        else if (player_status.isStreamFinished || q->blocked) //n=0 and (stream is over or queue is blocked)
+        else if ((q->finished && *q->finished) || q->blocked) //n=0 and (stream is over or queue is blocked)
         {
             res = 0;
             break;
         }
         else //n=0 and (stream is not over and queue is not blocked)
         {
-            while (!player_status.signal)
-            {
-                SDL_CondWait(q->cond , q->mutex);
-            }
+            SDL_CondWait(q->cond , q->mutex);
         }
     }
     SDL_UnlockMutex(q->mutex);
     return res;
 }
 
-int init(ElementType type , Queue* q)
+//get the first element without removing it, never waits
+//1 on success, 0 if the queue is empty
+int peek(Queue* q , void** elem)
+{
+    if (q == NULL) logger(EXIT_FAILURE , "NULL pointer error");
+    int res = 0;
+    SDL_LockMutex(q->mutex);
+    if (q->head->next != NULL)
+    {
+        *elem = q->head->next->e;
+        res = 1;
+    }
+    SDL_UnlockMutex(q->mutex);
+    return res;
+}
+
+//wake every waiting consumer so it re-checks `finished` and `blocked`
+int wakeup(Queue* q)
+{
+    SDL_LockMutex(q->mutex);
+    SDL_CondBroadcast(q->cond);
+    SDL_UnlockMutex(q->mutex);
+    return 1;
+}
+
+//drop every queued element: packets go back to the pool, frames are freed
+//return the number dropped
+int flush(Queue* q , PacketPool* pp)
+{
+    void* e;
+    int n = 0;
+    SDL_LockMutex(q->mutex);
+    while (q->head->next != NULL)
+    {
+        Node* temp = q->head->next;
+        q->head->next = temp->next;
+        e = temp->e;
+        temp->next = q->spare;
+        q->spare = temp;
+        if (q->type == AVPACKET)
+        {
+            packetPoolPut(pp , (AVPacket*)e);
+            q->bytes -= sizeof(AVPacket);
+        }
+        else
+        {
+            av_frame_free((AVFrame**)&e);
+            q->bytes -= sizeof(AVFrame);
+        }
+        n++;
+    }
+    q->rear = q->head;
+    q->n = 0;
+    SDL_CondBroadcast(q->cond);//a producer may wait for room
+    SDL_UnlockMutex(q->mutex);
+    return n;
+}
+
+int init(ElementType type , Queue* q , bool* finished)
 {
     if (!q->head)
     {
@@ -114,6 +191,7 @@ int init(ElementType type , Queue* q)
         q->head = head;
     }
     q->rear = q->head;
+    q->spare = NULL;
     q->n = 0;
     if (type == AVPACKET) q->max = PACKET_QUEUE_SIZE;
     else if (type == AVFRAME) q->max = FRAME_QUEUE_SIZE;
@@ -124,9 +202,54 @@ int init(ElementType type , Queue* q)
     q->isFull = isFull;
     q->dequeue = dequeue;
     q->enqueue = enqueue;
+    q->peek = peek;
+    q->wakeup = wakeup;
+    q->flush = flush;
     q->mutex = SDL_CreateMutex();
     q->cond = SDL_CreateCond();
     q->blocked = false;
+    q->finished = finished;
     q->type = type;
     return 1;
-}
\ No newline at end of file
+}
+
+//1 on success, 0 on failure
+int packetPoolInit(PacketPool* pp)
+{
+    pp->n = 0;
+    atomic_init(&pp->allocs , 0);
+    pp->mutex = SDL_CreateMutex();
+    return pp->mutex != NULL;
+}
+
+//a clean packet shell, from the pool if it has one
+AVPacket* packetPoolGet(PacketPool* pp)
+{
+    AVPacket* pkt = NULL;
+    SDL_LockMutex(pp->mutex);
+    if (pp->n > 0) pkt = pp->pkts[--pp->n];
+    SDL_UnlockMutex(pp->mutex);
+    if (!pkt)
+    {
+        pkt = av_packet_alloc();
+        if (!pkt) logger(EXIT_FAILURE , "Failed to alloc packet.");
+        atomic_fetch_add(&pp->allocs , 1);//any thread may take a shell
+    }
+    return pkt;
+}
+
+//drop the packet's data and keep the shell, a full pool frees it
+int packetPoolPut(PacketPool* pp , AVPacket* pkt)
+{
+    if (!pkt) return 0;
+    av_packet_unref(pkt);
+    SDL_LockMutex(pp->mutex);
+    if (pp->n < PACKET_POOL_SIZE)
+    {
+        pp->pkts[pp->n++] = pkt;
+        pkt = NULL;
+    }
+    SDL_UnlockMutex(pp->mutex);
+    if (pkt) av_packet_free(&pkt);
+    return 1;
+}
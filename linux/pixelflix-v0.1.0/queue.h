@@ -2,9 +2,11 @@
 #define QUEUE_H__
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <SDL2/SDL.h>
-#define PACKET_QUEUE_SIZE UINT32_MAX
-#define FRAME_QUEUE_SIZE UINT32_MAX
+#define PACKET_QUEUE_SIZE 256 //demux waits beyond this, which also bounds the packet shells in flight
+#define FRAME_QUEUE_SIZE 8 //decoded frames are big, the decoder waits for the renderer beyond this
+#define PACKET_POOL_SIZE (2 * PACKET_QUEUE_SIZE + 16) //spare shells kept, enough for both packet queues
 
 typedef enum {
     AVPACKET ,
@@ -18,10 +20,13 @@ typedef struct Node
     struct Node* next;
 }Node;
 
+struct PacketPool;
+
 typedef struct Queue
 {
     Node* head;
     Node* rear;
+    Node* spare;//dequeued nodes kept for the next enqueue, so a warm queue never allocates
     uint32_t n;
     uint32_t max;
     uint32_t bytes;
@@ -30,18 +35,38 @@ typedef struct Queue
     int (*isFull)(struct Queue* q);
     int (*enqueue)(struct Queue* q , void* p);
     int (*dequeue)(struct Queue* q , void** p);
+    int (*peek)(struct Queue* q , void** p);
+    int (*wakeup)(struct Queue* q);
+    int (*flush)(struct Queue* q , struct PacketPool* pp);
     SDL_mutex* mutex;
     SDL_cond* cond;
     bool blocked;
+    bool* finished;//producer's end flag, an empty queue returns instead of waiting once it is set
     ElementType type;
 }Queue;
 
-int init(ElementType type , Queue* q);
+//AVPacket shells handed back by the decoders and reused by demux,
+//so steady state playback does not allocate one per packet
+typedef struct PacketPool
+{
+    struct AVPacket* pkts[PACKET_POOL_SIZE];
+    int n;
+    atomic_ullong allocs;//shells allocated because the pool was empty
+    SDL_mutex* mutex;
+}PacketPool;
+
+int init(ElementType type , Queue* q , bool* finished);
 int destroy(Queue* q);
 int isEmpty(Queue* q);
 int isFull(Queue* q);
 int enqueue(Queue* q , void* p);
 int dequeue(Queue* q , void** p);
+int peek(Queue* q , void** p);
+int wakeup(Queue* q);
+int flush(Queue* q , PacketPool* pp);
+int packetPoolInit(PacketPool* pp);
+struct AVPacket* packetPoolGet(PacketPool* pp);
+int packetPoolPut(PacketPool* pp , struct AVPacket* pkt);
 
 
 
@@ -0,0 +1,85 @@
+#include "ring.h"
+#include <string.h>
+#include <libavutil/mem.h>
+
+//size is rounded up to a power of two
+//1 on success, 0 on failure
+int ringInit(Ring* r , size_t size)
+{
+    size_t cap = 1;
+    while (cap < size) cap <<= 1;
+    r->buf = (uint8_t*)av_malloc(cap);
+    if (!r->buf) return 0;
+    r->size = cap;
+    atomic_init(&r->wpos , 0);
+    atomic_init(&r->rpos , 0);
+    return 1;
+}
+
+int ringFree(Ring* r)
+{
+    av_freep(&r->buf);
+    r->size = 0;
+    return 1;
+}
+
+//producer side, copy as much of data as fits
+//return the bytes written
+size_t ringWrite(Ring* r , const uint8_t* data , size_t len)
+{
+    size_t w = atomic_load_explicit(&r->wpos , memory_order_relaxed);
+    size_t rd = atomic_load_explicit(&r->rpos , memory_order_acquire);
+    size_t space = r->size - (w - rd);
+    size_t off = w & (r->size - 1);
+    size_t first;
+    if (len > space) len = space;
+    first = r->size - off;
+    if (first > len) first = len;
+    memcpy(r->buf + off , data , first);
+    memcpy(r->buf , data + first , len - first);
+    atomic_store_explicit(&r->wpos , w + len , memory_order_release);
+    return len;
+}
+
+//consumer side, copy out as much as is buffered up to len
+//return the bytes read
+size_t ringRead(Ring* r , uint8_t* data , size_t len)
+{
+    size_t rd = atomic_load_explicit(&r->rpos , memory_order_relaxed);
+    size_t w = atomic_load_explicit(&r->wpos , memory_order_acquire);
+    size_t fill = w - rd;
+    size_t off = rd & (r->size - 1);
+    size_t first;
+    if (len > fill) len = fill;
+    first = r->size - off;
+    if (first > len) first = len;
+    memcpy(data , r->buf + off , first);
+    memcpy(data + first , r->buf , len - first);
+    atomic_store_explicit(&r->rpos , rd + len , memory_order_release);
+    return len;
+}
+
+//consumer side, drop up to len buffered bytes without reading them
+//return the bytes dropped
+size_t ringSkip(Ring* r , size_t len)
+{
+    size_t rd = atomic_load_explicit(&r->rpos , memory_order_relaxed);
+    size_t w = atomic_load_explicit(&r->wpos , memory_order_acquire);
+    if (len > w - rd) len = w - rd;
+    atomic_store_explicit(&r->rpos , rd + len , memory_order_release);
+    return len;
+}
+
+//bytes buffered, safe from either side
+size_t ringFill(Ring* r)
+{
+    size_t rd = atomic_load_explicit(&r->rpos , memory_order_acquire);
+    size_t w = atomic_load_explicit(&r->wpos , memory_order_acquire);
+    return w - rd;
+}
+
+//bytes that can be written, safe from either side
+size_t ringSpace(Ring* r)
+{
+    return r->size - ringFill(r);
+}
@@ -0,0 +1,26 @@
+#ifndef RING_H__
+#define RING_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+//single producer / single consumer byte ring, lock-free.
+//The producer only moves wpos and the consumer only moves rpos,
+//so the consumer side is safe to call from SDL's real-time audio thread.
+typedef struct Ring
+{
+    uint8_t* buf;
+    size_t size;//capacity in bytes, a power of two
+    atomic_size_t wpos;//total bytes written
+    atomic_size_t rpos;//total bytes read
+}Ring;
+
+int ringInit(Ring* r , size_t size);
+int ringFree(Ring* r);
+size_t ringWrite(Ring* r , const uint8_t* data , size_t len);
+size_t ringRead(Ring* r , uint8_t* data , size_t len);
+size_t ringSkip(Ring* r , size_t len);
+size_t ringFill(Ring* r);
+size_t ringSpace(Ring* r);
+
+#endif
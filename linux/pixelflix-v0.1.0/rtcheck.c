@@ -0,0 +1,188 @@
+#include "rtcheck.h"
+
+#if !defined(NDEBUG) && defined(__GLIBC__)
+#define _GNU_SOURCE //RTLD_NEXT
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+//the definitions below interpose the C library's for the whole program, they
+//forward to glibc's own entry points and only count while a thread is marked
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n , size_t size);
+extern void* __libc_realloc(void* ptr , size_t size);
+extern void __libc_free(void* ptr);
+extern void* __libc_memalign(size_t alignment , size_t size);
+extern ssize_t __write(int fd , const void* buf , size_t n);
+
+static __thread bool rt_thread;
+static __thread bool rt_watch;
+static __thread uint64_t rt_local[RTCHECK_KINDS];
+static atomic_ullong rt_count[RTCHECK_KINDS];
+static int (*real_mutex_lock)(pthread_mutex_t*);
+static int (*real_vfprintf)(FILE* , const char* , va_list);
+static int (*real_fputs)(const char* , FILE*);
+static int (*real_puts)(const char*);
+static size_t (*real_fwrite)(const void* , size_t , size_t , FILE*);
+
+//resolve the wrapped functions before main(), so no lookup happens on a real-time thread
+__attribute__((constructor))
+static void rtcheckInit(void)
+{
+    real_mutex_lock = (int (*)(pthread_mutex_t*))dlsym(RTLD_NEXT , "pthread_mutex_lock");
+    real_vfprintf = (int (*)(FILE* , const char* , va_list))dlsym(RTLD_NEXT , "vfprintf");
+    real_fputs = (int (*)(const char* , FILE*))dlsym(RTLD_NEXT , "fputs");
+    real_puts = (int (*)(const char*))dlsym(RTLD_NEXT , "puts");
+    real_fwrite = (size_t (*)(const void* , size_t , size_t , FILE*))dlsym(RTLD_NEXT , "fwrite");
+}
+
+static void rtcheckHit(enum RtcheckKind kind)
+{
+    if (rt_thread) atomic_fetch_add_explicit(&rt_count[kind] , 1 , memory_order_relaxed);
+    if (rt_watch) rt_local[kind]++;
+}
+
+void rtcheckEnter(void)
+{
+    rt_thread = true;
+}
+
+void rtcheckLeave(void)
+{
+    rt_thread = false;
+}
+
+uint64_t rtcheckCount(enum RtcheckKind kind)
+{
+    return atomic_load_explicit(&rt_count[kind] , memory_order_relaxed);
+}
+
+//count the calling thread's calls for rtcheckLocal(), returns the previous state so calls nest
+bool rtcheckWatch(bool on)
+{
+    bool was = rt_watch;
+    rt_watch = on;
+    return was;
+}
+
+uint64_t rtcheckLocal(enum RtcheckKind kind)
+{
+    return rt_local[kind];
+}
+
+void* malloc(size_t size)
+{
+    rtcheckHit(RTCHECK_ALLOC);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n , size_t size)
+{
+    rtcheckHit(RTCHECK_ALLOC);
+    return __libc_calloc(n , size);
+}
+
+void* realloc(void* ptr , size_t size)
+{
+    rtcheckHit(RTCHECK_ALLOC);
+    return __libc_realloc(ptr , size);
+}
+
+void free(void* ptr)
+{
+    rtcheckHit(RTCHECK_FREE);
+    __libc_free(ptr);
+}
+
+//av_malloc() ends here
+int posix_memalign(void** ptr , size_t alignment , size_t size)
+{
+    void* p;
+    rtcheckHit(RTCHECK_ALLOC);
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1))) return EINVAL;
+    p = __libc_memalign(alignment , size);
+    if (!p && size) return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment , size_t size)
+{
+    rtcheckHit(RTCHECK_ALLOC);
+    return __libc_memalign(alignment , size);
+}
+
+void* memalign(size_t alignment , size_t size)
+{
+    rtcheckHit(RTCHECK_ALLOC);
+    return __libc_memalign(alignment , size);
+}
+
+ssize_t write(int fd , const void* buf , size_t n)
+{
+    rtcheckHit(RTCHECK_STDIO);
+    return __write(fd , buf , n);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    rtcheckHit(RTCHECK_LOCK);
+    return real_mutex_lock(mutex);
+}
+
+//stdio writes with glibc's internal write, so the stdio entry points themselves are wrapped
+int vfprintf(FILE* stream , const char* format , va_list args)
+{
+    rtcheckHit(RTCHECK_STDIO);
+    return real_vfprintf(stream , format , args);
+}
+
+int vprintf(const char* format , va_list args)
+{
+    return vfprintf(stdout , format , args);
+}
+
+int fprintf(FILE* stream , const char* format , ...)
+{
+    va_list args;
+    int res;
+    va_start(args , format);
+    res = vfprintf(stream , format , args);
+    va_end(args);
+    return res;
+}
+
+int printf(const char* format , ...)
+{
+    va_list args;
+    int res;
+    va_start(args , format);
+    res = vfprintf(stdout , format , args);
+    va_end(args);
+    return res;
+}
+
+int fputs(const char* s , FILE* stream)
+{
+    rtcheckHit(RTCHECK_STDIO);
+    return real_fputs(s , stream);
+}
+
+int puts(const char* s)
+{
+    rtcheckHit(RTCHECK_STDIO);
+    return real_puts(s);
+}
+
+size_t fwrite(const void* ptr , size_t size , size_t n , FILE* stream)
+{
+    rtcheckHit(RTCHECK_STDIO);
+    return real_fwrite(ptr , size , n , stream);
+}
+#endif
@@ -0,0 +1,36 @@
+#ifndef RTCHECK_H__
+#define RTCHECK_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+//debug builds only: catch calls a real-time thread must never make.
+//Between rtcheckEnter() and rtcheckLeave() every heap allocation, mutex lock
+//and write(2) (all stdio ends there) made by the same thread is counted.
+//rtcheckWatch() keeps a separate count for the calling thread only, for checks
+//that a thread's own steady state stops allocating; such a check only logs, unless
+//built with RTCHECK_ABORT (make check).
+
+enum RtcheckKind
+{
+    RTCHECK_ALLOC ,
+    RTCHECK_FREE ,
+    RTCHECK_LOCK ,
+    RTCHECK_STDIO ,
+    RTCHECK_KINDS
+};
+
+#if !defined(NDEBUG) && defined(__GLIBC__)
+void rtcheckEnter(void);
+void rtcheckLeave(void);
+uint64_t rtcheckCount(enum RtcheckKind kind);
+bool rtcheckWatch(bool on);
+uint64_t rtcheckLocal(enum RtcheckKind kind);
+#else
+#define rtcheckEnter() ((void)0)
+#define rtcheckLeave() ((void)0)
+#define rtcheckCount(kind) ((uint64_t)0)
+static inline bool rtcheckWatch(bool on) { (void)on; return false; }
+#define rtcheckLocal(kind) ((uint64_t)0)
+#endif
+
+#endif
@@ -0,0 +1,513 @@
+#define _GNU_SOURCE //SCHED_IDLE
+#include "spectrum.h"
+#include "logger.h"
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <libavutil/common.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+//FFT passes on split real/imaginary arrays, after a bit reversal.
+//A radix-4 pass is two radix-2 stages fused (radix 2^2), so it runs on the plain
+//bit reversed order; an odd stage count ends with one radix-2 pass.
+//The SIMD versions run the butterflies of 4 or 8 neighbouring j at once.
+
+typedef struct FftKernels
+{
+    const char* name;
+    void (*pass4)(float* re , float* im , int n , int h , const float* twr , const float* twi);//stages 2h and 4h
+    void (*pass2)(float* re , float* im , int n , int h , const float* twr , const float* twi);//stage 2h
+}FftKernels;
+
+static void fftPass4C(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    for (int b = 0; b < n; b += 4 * h)
+    {
+        for (int j = 0; j < h; j++)
+        {
+            int a0 = b + j , a1 = a0 + h , a2 = a1 + h , a3 = a2 + h;
+            float w1r = twr[h + j] , w1i = twi[h + j];
+            float w2r = twr[2 * h + j] , w2i = twi[2 * h + j];
+            //stage 2h: (a0, a1) and (a2, a3)
+            float t1r = re[a1] * w1r - im[a1] * w1i , t1i = re[a1] * w1i + im[a1] * w1r;
+            float t3r = re[a3] * w1r - im[a3] * w1i , t3i = re[a3] * w1i + im[a3] * w1r;
+            float y0r = re[a0] + t1r , y0i = im[a0] + t1i;
+            float y1r = re[a0] - t1r , y1i = im[a0] - t1i;
+            float y2r = re[a2] + t3r , y2i = im[a2] + t3i;
+            float y3r = re[a2] - t3r , y3i = im[a2] - t3i;
+            //stage 4h: (a0, a2) by W_4h^j, (a1, a3) by W_4h^(j+h) = -i W_4h^j
+            float ur = y2r * w2r - y2i * w2i , ui = y2r * w2i + y2i * w2r;
+            float vr = y3r * w2i + y3i * w2r , vi = -(y3r * w2r - y3i * w2i);
+            re[a0] = y0r + ur;
+            im[a0] = y0i + ui;
+            re[a2] = y0r - ur;
+            im[a2] = y0i - ui;
+            re[a1] = y1r + vr;
+            im[a1] = y1i + vi;
+            re[a3] = y1r - vr;
+            im[a3] = y1i - vi;
+        }
+    }
+}
+
+static void fftPass2C(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    for (int b = 0; b < n; b += 2 * h)
+    {
+        for (int j = 0; j < h; j++)
+        {
+            int a0 = b + j , a1 = a0 + h;
+            float tr = re[a1] * twr[h + j] - im[a1] * twi[h + j];
+            float ti = re[a1] * twi[h + j] + im[a1] * twr[h + j];
+            re[a1] = re[a0] - tr;
+            im[a1] = im[a0] - ti;
+            re[a0] += tr;
+            im[a0] += ti;
+        }
+    }
+}
+
+static const FftKernels kernelsC = { "c" , fftPass4C , fftPass2C };
+
+#if defined(__x86_64__)
+static void fftPass4SSE2(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    if (h < 4)
+    {
+        fftPass4C(re , im , n , h , twr , twi);
+        return;
+    }
+    for (int b = 0; b < n; b += 4 * h)
+    {
+        for (int j = 0; j < h; j += 4)
+        {
+            float* r = re + b + j;
+            float* i = im + b + j;
+            __m128 w1r = _mm_loadu_ps(twr + h + j) , w1i = _mm_loadu_ps(twi + h + j);
+            __m128 w2r = _mm_loadu_ps(twr + 2 * h + j) , w2i = _mm_loadu_ps(twi + 2 * h + j);
+            __m128 x0r = _mm_loadu_ps(r) , x0i = _mm_loadu_ps(i);
+            __m128 x1r = _mm_loadu_ps(r + h) , x1i = _mm_loadu_ps(i + h);
+            __m128 x2r = _mm_loadu_ps(r + 2 * h) , x2i = _mm_loadu_ps(i + 2 * h);
+            __m128 x3r = _mm_loadu_ps(r + 3 * h) , x3i = _mm_loadu_ps(i + 3 * h);
+            __m128 t1r = _mm_sub_ps(_mm_mul_ps(x1r , w1r) , _mm_mul_ps(x1i , w1i));
+            __m128 t1i = _mm_add_ps(_mm_mul_ps(x1r , w1i) , _mm_mul_ps(x1i , w1r));
+            __m128 t3r = _mm_sub_ps(_mm_mul_ps(x3r , w1r) , _mm_mul_ps(x3i , w1i));
+            __m128 t3i = _mm_add_ps(_mm_mul_ps(x3r , w1i) , _mm_mul_ps(x3i , w1r));
+            __m128 y0r = _mm_add_ps(x0r , t1r) , y0i = _mm_add_ps(x0i , t1i);
+            __m128 y1r = _mm_sub_ps(x0r , t1r) , y1i = _mm_sub_ps(x0i , t1i);
+            __m128 y2r = _mm_add_ps(x2r , t3r) , y2i = _mm_add_ps(x2i , t3i);
+            __m128 y3r = _mm_sub_ps(x2r , t3r) , y3i = _mm_sub_ps(x2i , t3i);
+            __m128 ur = _mm_sub_ps(_mm_mul_ps(y2r , w2r) , _mm_mul_ps(y2i , w2i));
+            __m128 ui = _mm_add_ps(_mm_mul_ps(y2r , w2i) , _mm_mul_ps(y2i , w2r));
+            __m128 vr = _mm_add_ps(_mm_mul_ps(y3r , w2i) , _mm_mul_ps(y3i , w2r));
+            __m128 vi = _mm_sub_ps(_mm_mul_ps(y3i , w2i) , _mm_mul_ps(y3r , w2r));
+            _mm_storeu_ps(r , _mm_add_ps(y0r , ur));
+            _mm_storeu_ps(i , _mm_add_ps(y0i , ui));
+            _mm_storeu_ps(r + 2 * h , _mm_sub_ps(y0r , ur));
+            _mm_storeu_ps(i + 2 * h , _mm_sub_ps(y0i , ui));
+            _mm_storeu_ps(r + h , _mm_add_ps(y1r , vr));
+            _mm_storeu_ps(i + h , _mm_add_ps(y1i , vi));
+            _mm_storeu_ps(r + 3 * h , _mm_sub_ps(y1r , vr));
+            _mm_storeu_ps(i + 3 * h , _mm_sub_ps(y1i , vi));
+        }
+    }
+}
+
+static void fftPass2SSE2(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    if (h < 4)
+    {
+        fftPass2C(re , im , n , h , twr , twi);
+        return;
+    }
+    for (int b = 0; b < n; b += 2 * h)
+    {
+        for (int j = 0; j < h; j += 4)
+        {
+            float* r = re + b + j;
+            float* i = im + b + j;
+            __m128 wr = _mm_loadu_ps(twr + h + j) , wi = _mm_loadu_ps(twi + h + j);
+            __m128 x0r = _mm_loadu_ps(r) , x0i = _mm_loadu_ps(i);
+            __m128 x1r = _mm_loadu_ps(r + h) , x1i = _mm_loadu_ps(i + h);
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(x1r , wr) , _mm_mul_ps(x1i , wi));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(x1r , wi) , _mm_mul_ps(x1i , wr));
+            _mm_storeu_ps(r + h , _mm_sub_ps(x0r , tr));
+            _mm_storeu_ps(i + h , _mm_sub_ps(x0i , ti));
+            _mm_storeu_ps(r , _mm_add_ps(x0r , tr));
+            _mm_storeu_ps(i , _mm_add_ps(x0i , ti));
+        }
+    }
+}
+
+static const FftKernels kernelsSSE2 = { "sse2" , fftPass4SSE2 , fftPass2SSE2 };
+
+__attribute__((target("avx2")))
+static void fftPass4AVX2(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    if (h < 8)
+    {
+        fftPass4SSE2(re , im , n , h , twr , twi);
+        return;
+    }
+    for (int b = 0; b < n; b += 4 * h)
+    {
+        for (int j = 0; j < h; j += 8)
+        {
+            float* r = re + b + j;
+            float* i = im + b + j;
+            __m256 w1r = _mm256_loadu_ps(twr + h + j) , w1i = _mm256_loadu_ps(twi + h + j);
+            __m256 w2r = _mm256_loadu_ps(twr + 2 * h + j) , w2i = _mm256_loadu_ps(twi + 2 * h + j);
+            __m256 x0r = _mm256_loadu_ps(r) , x0i = _mm256_loadu_ps(i);
+            __m256 x1r = _mm256_loadu_ps(r + h) , x1i = _mm256_loadu_ps(i + h);
+            __m256 x2r = _mm256_loadu_ps(r + 2 * h) , x2i = _mm256_loadu_ps(i + 2 * h);
+            __m256 x3r = _mm256_loadu_ps(r + 3 * h) , x3i = _mm256_loadu_ps(i + 3 * h);
+            __m256 t1r = _mm256_sub_ps(_mm256_mul_ps(x1r , w1r) , _mm256_mul_ps(x1i , w1i));
+            __m256 t1i = _mm256_add_ps(_mm256_mul_ps(x1r , w1i) , _mm256_mul_ps(x1i , w1r));
+            __m256 t3r = _mm256_sub_ps(_mm256_mul_ps(x3r , w1r) , _mm256_mul_ps(x3i , w1i));
+            __m256 t3i = _mm256_add_ps(_mm256_mul_ps(x3r , w1i) , _mm256_mul_ps(x3i , w1r));
+            __m256 y0r = _mm256_add_ps(x0r , t1r) , y0i = _mm256_add_ps(x0i , t1i);
+            __m256 y1r = _mm256_sub_ps(x0r , t1r) , y1i = _mm256_sub_ps(x0i , t1i);
+            __m256 y2r = _mm256_add_ps(x2r , t3r) , y2i = _mm256_add_ps(x2i , t3i);
+            __m256 y3r = _mm256_sub_ps(x2r , t3r) , y3i = _mm256_sub_ps(x2i , t3i);
+            __m256 ur = _mm256_sub_ps(_mm256_mul_ps(y2r , w2r) , _mm256_mul_ps(y2i , w2i));
+            __m256 ui = _mm256_add_ps(_mm256_mul_ps(y2r , w2i) , _mm256_mul_ps(y2i , w2r));
+            __m256 vr = _mm256_add_ps(_mm256_mul_ps(y3r , w2i) , _mm256_mul_ps(y3i , w2r));
+            __m256 vi = _mm256_sub_ps(_mm256_mul_ps(y3i , w2i) , _mm256_mul_ps(y3r , w2r));
+            _mm256_storeu_ps(r , _mm256_add_ps(y0r , ur));
+            _mm256_storeu_ps(i , _mm256_add_ps(y0i , ui));
+            _mm256_storeu_ps(r + 2 * h , _mm256_sub_ps(y0r , ur));
+            _mm256_storeu_ps(i + 2 * h , _mm256_sub_ps(y0i , ui));
+            _mm256_storeu_ps(r + h , _mm256_add_ps(y1r , vr));
+            _mm256_storeu_ps(i + h , _mm256_add_ps(y1i , vi));
+            _mm256_storeu_ps(r + 3 * h , _mm256_sub_ps(y1r , vr));
+            _mm256_storeu_ps(i + 3 * h , _mm256_sub_ps(y1i , vi));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void fftPass2AVX2(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    if (h < 8)
+    {
+        fftPass2SSE2(re , im , n , h , twr , twi);
+        return;
+    }
+    for (int b = 0; b < n; b += 2 * h)
+    {
+        for (int j = 0; j < h; j += 8)
+        {
+            float* r = re + b + j;
+            float* i = im + b + j;
+            __m256 wr = _mm256_loadu_ps(twr + h + j) , wi = _mm256_loadu_ps(twi + h + j);
+            __m256 x0r = _mm256_loadu_ps(r) , x0i = _mm256_loadu_ps(i);
+            __m256 x1r = _mm256_loadu_ps(r + h) , x1i = _mm256_loadu_ps(i + h);
+            __m256 tr = _mm256_sub_ps(_mm256_mul_ps(x1r , wr) , _mm256_mul_ps(x1i , wi));
+            __m256 ti = _mm256_add_ps(_mm256_mul_ps(x1r , wi) , _mm256_mul_ps(x1i , wr));
+            _mm256_storeu_ps(r + h , _mm256_sub_ps(x0r , tr));
+            _mm256_storeu_ps(i + h , _mm256_sub_ps(x0i , ti));
+            _mm256_storeu_ps(r , _mm256_add_ps(x0r , tr));
+            _mm256_storeu_ps(i , _mm256_add_ps(x0i , ti));
+        }
+    }
+}
+
+static const FftKernels kernelsAVX2 = { "avx2" , fftPass4AVX2 , fftPass2AVX2 };
+#endif
+
+#if defined(__aarch64__)
+static void fftPass4NEON(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    if (h < 4)
+    {
+        fftPass4C(re , im , n , h , twr , twi);
+        return;
+    }
+    for (int b = 0; b < n; b += 4 * h)
+    {
+        for (int j = 0; j < h; j += 4)
+        {
+            float* r = re + b + j;
+            float* i = im + b + j;
+            float32x4_t w1r = vld1q_f32(twr + h + j) , w1i = vld1q_f32(twi + h + j);
+            float32x4_t w2r = vld1q_f32(twr + 2 * h + j) , w2i = vld1q_f32(twi + 2 * h + j);
+            float32x4_t x0r = vld1q_f32(r) , x0i = vld1q_f32(i);
+            float32x4_t x1r = vld1q_f32(r + h) , x1i = vld1q_f32(i + h);
+            float32x4_t x2r = vld1q_f32(r + 2 * h) , x2i = vld1q_f32(i + 2 * h);
+            float32x4_t x3r = vld1q_f32(r + 3 * h) , x3i = vld1q_f32(i + 3 * h);
+            float32x4_t t1r = vmlsq_f32(vmulq_f32(x1r , w1r) , x1i , w1i);
+            float32x4_t t1i = vmlaq_f32(vmulq_f32(x1r , w1i) , x1i , w1r);
+            float32x4_t t3r = vmlsq_f32(vmulq_f32(x3r , w1r) , x3i , w1i);
+            float32x4_t t3i = vmlaq_f32(vmulq_f32(x3r , w1i) , x3i , w1r);
+            float32x4_t y0r = vaddq_f32(x0r , t1r) , y0i = vaddq_f32(x0i , t1i);
+            float32x4_t y1r = vsubq_f32(x0r , t1r) , y1i = vsubq_f32(x0i , t1i);
+            float32x4_t y2r = vaddq_f32(x2r , t3r) , y2i = vaddq_f32(x2i , t3i);
+            float32x4_t y3r = vsubq_f32(x2r , t3r) , y3i = vsubq_f32(x2i , t3i);
+            float32x4_t ur = vmlsq_f32(vmulq_f32(y2r , w2r) , y2i , w2i);
+            float32x4_t ui = vmlaq_f32(vmulq_f32(y2r , w2i) , y2i , w2r);
+            float32x4_t vr = vmlaq_f32(vmulq_f32(y3r , w2i) , y3i , w2r);
+            float32x4_t vi = vmlsq_f32(vmulq_f32(y3i , w2i) , y3r , w2r);
+            vst1q_f32(r , vaddq_f32(y0r , ur));
+            vst1q_f32(i , vaddq_f32(y0i , ui));
+            vst1q_f32(r + 2 * h , vsubq_f32(y0r , ur));
+            vst1q_f32(i + 2 * h , vsubq_f32(y0i , ui));
+            vst1q_f32(r + h , vaddq_f32(y1r , vr));
+            vst1q_f32(i + h , vaddq_f32(y1i , vi));
+            vst1q_f32(r + 3 * h , vsubq_f32(y1r , vr));
+            vst1q_f32(i + 3 * h , vsubq_f32(y1i , vi));
+        }
+    }
+}
+
+static void fftPass2NEON(float* re , float* im , int n , int h , const float* twr , const float* twi)
+{
+    if (h < 4)
+    {
+        fftPass2C(re , im , n , h , twr , twi);
+        return;
+    }
+    for (int b = 0; b < n; b += 2 * h)
+    {
+        for (int j = 0; j < h; j += 4)
+        {
+            float* r = re + b + j;
+            float* i = im + b + j;
+            float32x4_t wr = vld1q_f32(twr + h + j) , wi = vld1q_f32(twi + h + j);
+            float32x4_t x0r = vld1q_f32(r) , x0i = vld1q_f32(i);
+            float32x4_t x1r = vld1q_f32(r + h) , x1i = vld1q_f32(i + h);
+            float32x4_t tr = vmlsq_f32(vmulq_f32(x1r , wr) , x1i , wi);
+            float32x4_t ti = vmlaq_f32(vmulq_f32(x1r , wi) , x1i , wr);
+            vst1q_f32(r + h , vsubq_f32(x0r , tr));
+            vst1q_f32(i + h , vsubq_f32(x0i , ti));
+            vst1q_f32(r , vaddq_f32(x0r , tr));
+            vst1q_f32(i , vaddq_f32(x0i , ti));
+        }
+    }
+}
+
+static const FftKernels kernelsNEON = { "neon" , fftPass4NEON , fftPass2NEON };
+#endif
+
+static const FftKernels* kernels = &kernelsC;
+
+//---------------------------------------------------------------------------
+
+//tables for the FFT and the band edges, a history of `history` bytes (rounded up to a power of two)
+//return 1 on success, 0 on failure
+int spectrumInit(Spectrum* sp , enum AVSampleFormat fmt , int channels , int freq , size_t history)
+{
+    int flags = av_get_cpu_flags();
+    const int n = SPECTRUM_FFT_SIZE;
+    double hi = FFMIN(SPECTRUM_MAX_HZ , freq / 2.0);
+    size_t cap = 1;
+
+    memset(sp , 0 , sizeof(*sp));
+    sp->fmt = av_get_packed_sample_fmt(fmt);
+    if (sp->fmt != AV_SAMPLE_FMT_S16 && sp->fmt != AV_SAMPLE_FMT_S32 && sp->fmt != AV_SAMPLE_FMT_FLT) return 0;
+    sp->channels = channels;
+    sp->frame_size = channels * av_get_bytes_per_sample(sp->fmt);
+    while (cap < history) cap <<= 1;
+    sp->hist = (uint8_t*)av_malloc(cap);
+    if (!sp->hist) return 0;
+    sp->size = cap;
+    atomic_init(&sp->wpos , 0);
+    atomic_init(&sp->seq , 0);
+
+    for (int i = 0; i < n; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < SPECTRUM_FFT_BITS; b++) r |= ((i >> b) & 1) << (SPECTRUM_FFT_BITS - 1 - b);
+        sp->rev[i] = (uint16_t)r;
+        sp->hann[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / n);
+    }
+    for (int m = 2; m <= n; m <<= 1)
+    {
+        for (int j = 0; j < m / 2; j++)
+        {
+            sp->tw_re[m / 2 + j] = (float)cos(-2.0 * M_PI * j / m);
+            sp->tw_im[m / 2 + j] = (float)sin(-2.0 * M_PI * j / m);
+        }
+    }
+    //log spaced bands, each at least one bin wide
+    for (int b = 0; b <= SPECTRUM_BANDS; b++)
+    {
+        double f = SPECTRUM_MIN_HZ * pow(hi / SPECTRUM_MIN_HZ , (double)b / SPECTRUM_BANDS);
+        sp->edge[b] = (int)(f * n / freq);
+        if (b > 0 && sp->edge[b] <= sp->edge[b - 1]) sp->edge[b] = sp->edge[b - 1] + 1;
+    }
+    if (sp->edge[SPECTRUM_BANDS] > n / 2) sp->edge[SPECTRUM_BANDS] = n / 2;
+
+    kernels = &kernelsC;
+#if defined(__x86_64__)
+    if (flags & AV_CPU_FLAG_AVX2) kernels = &kernelsAVX2;
+    else if (flags & AV_CPU_FLAG_SSE2) kernels = &kernelsSSE2;
+#elif defined(__aarch64__)
+    if (flags & AV_CPU_FLAG_NEON) kernels = &kernelsNEON;
+#else
+    (void)flags;
+#endif
+    logger(LOG , "Spectrum FFT kernels: %s" , kernels->name);
+    return 1;
+}
+
+void spectrumFree(Spectrum* sp)
+{
+    av_freep(&sp->hist);
+}
+
+//tap: keep the PCM just handed to the ring, overwriting the oldest. Called by the
+//audio decode thread, costs a copy and never waits for the analyzer
+void spectrumWrite(Spectrum* sp , const uint8_t* data , size_t len)
+{
+    size_t wpos = atomic_load_explicit(&sp->wpos , memory_order_relaxed);
+    size_t off , n;
+    if (!sp->hist) return;
+    if (len > sp->size)
+    {
+        //only the tail can be kept
+        wpos += len - sp->size;
+        data += len - sp->size;
+        len = sp->size;
+    }
+    while (len > 0)
+    {
+        off = wpos & (sp->size - 1);
+        n = FFMIN(len , sp->size - off);
+        memcpy(sp->hist + off , data , n);
+        data += n;
+        len -= n;
+        wpos += n;
+    }
+    atomic_store_explicit(&sp->wpos , wpos , memory_order_release);
+}
+
+//`frames` frames of history from byte position `pos`, downmixed to mono.
+//0 if they aren't written yet or were overwritten while copying
+static int spectrumLoad(Spectrum* sp , float* dst , size_t pos , int frames)
+{
+    size_t len = (size_t)frames * sp->frame_size;
+    size_t wpos = atomic_load_explicit(&sp->wpos , memory_order_acquire);
+    float scale = 1.0f / sp->channels;
+    if (pos + len > wpos || wpos - pos > sp->size) return 0;
+    int bps = sp->frame_size / sp->channels;
+    for (int f = 0; f < frames; f++)
+    {
+        float sum = 0;
+        //a sample never straddles the wrap (2 or 4 bytes into a power of two), a frame of 3 or 6 channels can
+        for (int c = 0; c < sp->channels; c++)
+        {
+            const uint8_t* p = sp->hist + ((pos + (size_t)f * sp->frame_size + (size_t)c * bps) & (sp->size - 1));
+            if (sp->fmt == AV_SAMPLE_FMT_FLT) sum += *(const float*)p;
+            else if (sp->fmt == AV_SAMPLE_FMT_S32) sum += *(const int32_t*)p * (1.0f / 2147483648.0f);
+            else sum += *(const int16_t*)p * (1.0f / 32768.0f);
+        }
+        dst[f] = sum * scale;
+    }
+    //the writer may have lapped us while we copied
+    atomic_thread_fence(memory_order_acquire);
+    wpos = atomic_load_explicit(&sp->wpos , memory_order_relaxed);
+    return wpos - pos <= sp->size;
+}
+
+//window, FFT and band levels of the current mono window, then publish them
+static void spectrumAnalyze(Spectrum* sp)
+{
+    const int n = SPECTRUM_FFT_SIZE;
+    //a full scale sine peaks at n/4 with the hann window
+    const float norm = 1.0f / ((n / 4.0f) * (n / 4.0f));
+    int h = 1;
+    unsigned int seq;
+
+    for (int i = 0; i < n; i++)
+    {
+        sp->re[sp->rev[i]] = sp->mono[i] * sp->hann[i];
+        sp->im[sp->rev[i]] = 0;
+    }
+    for (; h * 4 <= n; h *= 4) kernels->pass4(sp->re , sp->im , n , h , sp->tw_re , sp->tw_im);
+    if (h < n) kernels->pass2(sp->re , sp->im , n , h , sp->tw_re , sp->tw_im);
+
+    for (int b = 0; b < SPECTRUM_BANDS; b++)
+    {
+        float peak = 0 , v;
+        for (int k = sp->edge[b]; k < sp->edge[b + 1]; k++)
+            peak = FFMAX(peak , sp->re[k] * sp->re[k] + sp->im[k] * sp->im[k]);
+        v = (float)((10.0 * log10(peak * norm + 1e-12) - SPECTRUM_FLOOR_DB) / -SPECTRUM_FLOOR_DB);
+        v = av_clipf(v , 0 , 1);
+        //rise at once, fall slowly, so bars don't flicker
+        sp->level[b] = FFMAX(v , sp->level[b] * SPECTRUM_RELEASE);
+    }
+
+    seq = atomic_load_explicit(&sp->seq , memory_order_relaxed);
+    atomic_store_explicit(&sp->seq , seq + 1 , memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(sp->bands , sp->level , sizeof(sp->bands));
+    atomic_store_explicit(&sp->seq , seq + 2 , memory_order_release);
+}
+
+//analyze up to the PCM byte position `audible`, one FFT per hop: each hop only
+//downmixes its own new samples into the sliding window.
+//return the number of FFTs run
+int spectrumStep(Spectrum* sp , size_t audible)
+{
+    const size_t hop = (size_t)SPECTRUM_HOP * sp->frame_size;
+    const size_t win = (size_t)SPECTRUM_FFT_SIZE * sp->frame_size;
+    int n = 0;
+    if (!sp->hist || audible < win) return 0;
+    //first window, or far behind (a stall or a speed change): restart from a full window
+    //instead of catching up hop by hop on sound that has already been heard
+    if (!sp->primed || audible < sp->pos || audible - sp->pos > 4 * hop)
+    {
+        sp->pos = audible - (audible % sp->frame_size);
+        sp->primed = spectrumLoad(sp , sp->mono , sp->pos - win , SPECTRUM_FFT_SIZE);
+        if (!sp->primed) return 0;
+        spectrumAnalyze(sp);
+        return 1;
+    }
+    while (audible - sp->pos >= hop)
+    {
+        memmove(sp->mono , sp->mono + SPECTRUM_HOP , (SPECTRUM_FFT_SIZE - SPECTRUM_HOP) * sizeof(float));
+        if (!spectrumLoad(sp , sp->mono + SPECTRUM_FFT_SIZE - SPECTRUM_HOP , sp->pos , SPECTRUM_HOP))
+        {
+            sp->primed = false;
+            break;
+        }
+        sp->pos += hop;
+        spectrumAnalyze(sp);
+        n++;
+    }
+    return n;
+}
+
+//copy the latest band levels, 0 before the first analysis
+int spectrumRead(Spectrum* sp , float* bands)
+{
+    unsigned int seq;
+    do
+    {
+        seq = atomic_load_explicit(&sp->seq , memory_order_acquire);
+        memcpy(bands , sp->bands , sizeof(sp->bands));
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&sp->seq , memory_order_relaxed));
+    return seq != 0;
+}
+
+//run the calling thread only when nothing else wants the cpu
+void spectrumLowerPriority(void)
+{
+#if defined(SCHED_IDLE)
+    struct sched_param param = { 0 };
+    if (pthread_setschedparam(pthread_self() , SCHED_IDLE , &param))
+        logger(LOG , "Spectrum thread keeps its normal priority.");
+#endif
+}
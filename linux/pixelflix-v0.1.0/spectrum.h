@@ -0,0 +1,54 @@
+#ifndef SPECTRUM_H__
+#define SPECTRUM_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <libavutil/samplefmt.h>
+
+//spectrum analyzer: a tap on the converted PCM, analyzed on its own low priority
+//thread and read by a render loop as band levels
+
+#define SPECTRUM_FFT_BITS 11
+#define SPECTRUM_FFT_SIZE (1 << SPECTRUM_FFT_BITS) //~43 ms at 48 kHz
+#define SPECTRUM_HOP (SPECTRUM_FFT_SIZE / 4) //75% overlap between windows
+#define SPECTRUM_BANDS 32 //log spaced between SPECTRUM_MIN_HZ and SPECTRUM_MAX_HZ
+#define SPECTRUM_MIN_HZ 40.0
+#define SPECTRUM_MAX_HZ 16000.0
+#define SPECTRUM_FLOOR_DB -80.0 //level 0, full scale is level 1
+#define SPECTRUM_RELEASE 0.85f //per hop decay of a falling band
+
+typedef struct Spectrum
+{
+    //tap: recent PCM, overwritten by the audio decode thread, never blocks it
+    uint8_t* hist;
+    size_t size;//a power of two
+    atomic_size_t wpos;//total bytes written, the same positions as the PCM ring
+    enum AVSampleFormat fmt;//packed S16, S32 or FLT
+    int channels;
+    int frame_size;
+    //analysis, on the spectrum thread only
+    size_t pos;//PCM byte position the current window ends at
+    bool primed;//mono holds a full window
+    float mono[SPECTRUM_FFT_SIZE];//sliding window of downmixed samples
+    float hann[SPECTRUM_FFT_SIZE];
+    float re[SPECTRUM_FFT_SIZE];
+    float im[SPECTRUM_FFT_SIZE];
+    float tw_re[SPECTRUM_FFT_SIZE];//W_m^j for each stage size m, at offset m/2
+    float tw_im[SPECTRUM_FFT_SIZE];
+    uint16_t rev[SPECTRUM_FFT_SIZE];//bit reversal
+    int edge[SPECTRUM_BANDS + 1];//first bin of every band
+    float level[SPECTRUM_BANDS];
+    //published band levels 0..1, seqlocked
+    atomic_uint seq;
+    float bands[SPECTRUM_BANDS];
+}Spectrum;
+
+int spectrumInit(Spectrum* sp , enum AVSampleFormat fmt , int channels , int freq , size_t history);
+void spectrumFree(Spectrum* sp);
+void spectrumWrite(Spectrum* sp , const uint8_t* data , size_t len);
+int spectrumStep(Spectrum* sp , size_t audible);
+int spectrumRead(Spectrum* sp , float* bands);
+void spectrumLowerPriority(void);
+
+#endif
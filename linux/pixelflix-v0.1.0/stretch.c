@@ -0,0 +1,403 @@
+#include "stretch.h"
+#include "logger.h"
+#include <string.h>
+#include <math.h>
+#include <libavutil/cpu.h>
+#include <libavutil/mem.h>
+#include <libavutil/common.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//---------------------------------------------------------------------------
+//kernels, one set per instruction set, picked at runtime by stretchInit().
+//Both work on interleaved samples, so they don't care about the channel count.
+
+typedef struct StretchKernels
+{
+    const char* name;
+    void (*dot2)(const float* a , const float* b , int n , float* ab , float* bb);//a.b and b.b
+    void (*crossfade)(float* dst , const float* a , const float* b , const float* w , int n);//a + (b - a) * w
+}StretchKernels;
+
+static void dot2C(const float* a , const float* b , int n , float* ab , float* bb)
+{
+    float sab = 0 , sbb = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sab += a[i] * b[i];
+        sbb += b[i] * b[i];
+    }
+    *ab = sab;
+    *bb = sbb;
+}
+
+static void crossfadeC(float* dst , const float* a , const float* b , const float* w , int n)
+{
+    for (int i = 0; i < n; i++) dst[i] = a[i] + (b[i] - a[i]) * w[i];
+}
+
+static const StretchKernels kernelsC = { "c" , dot2C , crossfadeC };
+
+#if defined(__x86_64__)
+static void dot2SSE2(const float* a , const float* b , int n , float* ab , float* bb)
+{
+    __m128 sab = _mm_setzero_ps();
+    __m128 sbb = _mm_setzero_ps();
+    float t[4];
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 vb = _mm_loadu_ps(b + i);
+        sab = _mm_add_ps(sab , _mm_mul_ps(_mm_loadu_ps(a + i) , vb));
+        sbb = _mm_add_ps(sbb , _mm_mul_ps(vb , vb));
+    }
+    dot2C(a + i , b + i , n - i , ab , bb);
+    _mm_storeu_ps(t , sab);
+    *ab += t[0] + t[1] + t[2] + t[3];
+    _mm_storeu_ps(t , sbb);
+    *bb += t[0] + t[1] + t[2] + t[3];
+}
+
+static void crossfadeSSE2(float* dst , const float* a , const float* b , const float* w , int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 va = _mm_loadu_ps(a + i);
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(b + i) , va);
+        _mm_storeu_ps(dst + i , _mm_add_ps(va , _mm_mul_ps(d , _mm_loadu_ps(w + i))));
+    }
+    crossfadeC(dst + i , a + i , b + i , w + i , n - i);
+}
+
+static const StretchKernels kernelsSSE2 = { "sse2" , dot2SSE2 , crossfadeSSE2 };
+
+__attribute__((target("avx2")))
+static void dot2AVX2(const float* a , const float* b , int n , float* ab , float* bb)
+{
+    __m256 sab = _mm256_setzero_ps();
+    __m256 sbb = _mm256_setzero_ps();
+    float t[8];
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 vb = _mm256_loadu_ps(b + i);
+        sab = _mm256_add_ps(sab , _mm256_mul_ps(_mm256_loadu_ps(a + i) , vb));
+        sbb = _mm256_add_ps(sbb , _mm256_mul_ps(vb , vb));
+    }
+    dot2C(a + i , b + i , n - i , ab , bb);
+    _mm256_storeu_ps(t , sab);
+    *ab += t[0] + t[1] + t[2] + t[3] + t[4] + t[5] + t[6] + t[7];
+    _mm256_storeu_ps(t , sbb);
+    *bb += t[0] + t[1] + t[2] + t[3] + t[4] + t[5] + t[6] + t[7];
+}
+
+__attribute__((target("avx2")))
+static void crossfadeAVX2(float* dst , const float* a , const float* b , const float* w , int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(b + i) , va);
+        _mm256_storeu_ps(dst + i , _mm256_add_ps(va , _mm256_mul_ps(d , _mm256_loadu_ps(w + i))));
+    }
+    crossfadeC(dst + i , a + i , b + i , w + i , n - i);
+}
+
+static const StretchKernels kernelsAVX2 = { "avx2" , dot2AVX2 , crossfadeAVX2 };
+#endif
+
+#if defined(__aarch64__)
+static void dot2NEON(const float* a , const float* b , int n , float* ab , float* bb)
+{
+    float32x4_t sab = vdupq_n_f32(0);
+    float32x4_t sbb = vdupq_n_f32(0);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t vb = vld1q_f32(b + i);
+        sab = vmlaq_f32(sab , vld1q_f32(a + i) , vb);
+        sbb = vmlaq_f32(sbb , vb , vb);
+    }
+    dot2C(a + i , b + i , n - i , ab , bb);
+    *ab += vaddvq_f32(sab);
+    *bb += vaddvq_f32(sbb);
+}
+
+static void crossfadeNEON(float* dst , const float* a , const float* b , const float* w , int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        float32x4_t va = vld1q_f32(a + i);
+        vst1q_f32(dst + i , vmlaq_f32(va , vsubq_f32(vld1q_f32(b + i) , va) , vld1q_f32(w + i)));
+    }
+    crossfadeC(dst + i , a + i , b + i , w + i , n - i);
+}
+
+static const StretchKernels kernelsNEON = { "neon" , dot2NEON , crossfadeNEON };
+#endif
+
+static const StretchKernels* kernels = &kernelsC;
+
+//---------------------------------------------------------------------------
+
+//frames of PCM in `fmt` -> interleaved float
+static void stretchUnpack(Stretch* st , float* dst , const uint8_t* src , int frames)
+{
+    int n = frames * st->channels;
+    if (st->fmt == AV_SAMPLE_FMT_FLT)
+    {
+        memcpy(dst , src , (size_t)n * sizeof(float));
+    }
+    else if (st->fmt == AV_SAMPLE_FMT_S32)
+    {
+        const int32_t* s = (const int32_t*)src;
+        for (int i = 0; i < n; i++) dst[i] = s[i] * (1.0f / 2147483648.0f);
+    }
+    else
+    {
+        const int16_t* s = (const int16_t*)src;
+        for (int i = 0; i < n; i++) dst[i] = s[i] * (1.0f / 32768.0f);
+    }
+}
+
+//interleaved float -> `fmt`, handed to emit
+static void stretchEmit(Stretch* st , const float* src , int frames , StretchEmit emit , void* opaque)
+{
+    int n = frames * st->channels;
+    if (n <= 0) return;
+    if (st->fmt == AV_SAMPLE_FMT_FLT)
+    {
+        emit(opaque , (const uint8_t*)src , n * (int)sizeof(float));
+        return;
+    }
+    if (st->fmt == AV_SAMPLE_FMT_S32)
+    {
+        int32_t* d = (int32_t*)st->pack;
+        for (int i = 0; i < n; i++)
+        {
+            double v = src[i] * 2147483648.0;
+            d[i] = v >= 2147483647.0 ? INT32_MAX : v <= -2147483648.0 ? INT32_MIN : (int32_t)lrint(v);
+        }
+    }
+    else
+    {
+        int16_t* d = (int16_t*)st->pack;
+        for (int i = 0; i < n; i++)
+        {
+            long v = lrintf(src[i] * 32768.0f);
+            d[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : (int16_t)v;
+        }
+    }
+    emit(opaque , st->pack , n * st->bytes_per_sample);
+}
+
+static double stretchScore(Stretch* st , const float* in)
+{
+    float ab , bb;
+    kernels->dot2(st->mid , in , st->overlap * st->channels , &ab , &bb);
+    return ab / sqrt(bb + 1e-9);
+}
+
+//offset in [0, seek) where the input best continues the last piece: normalized
+//cross-correlation with its tail, on every 4th frame first, then around the best one
+static int stretchSeek(Stretch* st , const float* in)
+{
+    int ch = st->channels;
+    int best = 0 , coarse;
+    double score , best_score = -INFINITY;
+    for (int k = 0; k < st->seek; k += 4)
+    {
+        score = stretchScore(st , in + (size_t)k * ch);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = k;
+        }
+    }
+    coarse = best;
+    for (int k = FFMAX(coarse - 3 , 0); k <= FFMIN(coarse + 3 , st->seek - 1); k++)
+    {
+        if (k == coarse) continue;
+        score = stretchScore(st , in + (size_t)k * ch);
+        if (score > best_score)
+        {
+            best_score = score;
+            best = k;
+        }
+    }
+    return best;
+}
+
+//one WSOLA step: splice the best matching piece onto the last one and emit
+//sequence - overlap frames, while the input advances by rate times that.
+//0 if there isn't enough input buffered yet
+static int stretchStep(Stretch* st , double rate , StretchEmit emit , void* opaque)
+{
+    int ch = st->channels;
+    int ip = (int)st->in_pos;
+    int best = 0;
+    if (ip + st->seek + st->sequence > st->in_len) return 0;
+
+    if (st->have_mid)
+    {
+        best = stretchSeek(st , st->in + (size_t)ip * ch);
+        kernels->crossfade(st->out , st->mid , st->in + (size_t)(ip + best) * ch , st->fade , st->overlap * ch);
+    }
+    else
+    {
+        memcpy(st->out , st->in + (size_t)ip * ch , (size_t)st->overlap * ch * sizeof(float));
+    }
+    memcpy(st->out + (size_t)st->overlap * ch , st->in + (size_t)(ip + best + st->overlap) * ch ,
+        (size_t)(st->sequence - 2 * st->overlap) * ch * sizeof(float));
+    memcpy(st->mid , st->in + (size_t)(ip + best + st->sequence - st->overlap) * ch ,
+        (size_t)st->overlap * ch * sizeof(float));
+    st->have_mid = true;
+    st->out_src = ip + best + st->sequence - st->overlap;
+    st->in_pos += (st->sequence - st->overlap) * rate;
+    stretchEmit(st , st->out , st->sequence - st->overlap , emit , opaque);
+    return 1;
+}
+
+//drop the input no step will look at again
+static void stretchCompact(Stretch* st)
+{
+    int drop = FFMIN((int)st->in_pos , st->in_len);//speeding up can skip past the buffered input
+    if (drop <= 0) return;
+    memmove(st->in , st->in + (size_t)drop * st->channels , (size_t)(st->in_len - drop) * st->channels * sizeof(float));
+    st->in_len -= drop;
+    st->in_pos -= drop;
+    st->out_src -= drop;
+}
+
+//buffers for PCM in a packed fmt at freq, and the widest kernel set the cpu runs
+//return 1 on success, 0 on failure
+int stretchInit(Stretch* st , enum AVSampleFormat fmt , int channels , int freq)
+{
+    int flags = av_get_cpu_flags();
+    memset(st , 0 , sizeof(*st));
+    st->fmt = av_get_packed_sample_fmt(fmt);
+    if (st->fmt != AV_SAMPLE_FMT_S16 && st->fmt != AV_SAMPLE_FMT_S32 && st->fmt != AV_SAMPLE_FMT_FLT) return 0;
+    st->channels = channels;
+    st->bytes_per_sample = av_get_bytes_per_sample(st->fmt);
+    st->sequence = freq * STRETCH_SEQUENCE_MS / 1000;
+    st->seek = freq * STRETCH_SEEK_MS / 1000;
+    st->overlap = freq * STRETCH_OVERLAP_MS / 1000;
+    //a second of input, far more than a step at the fastest rate skips over
+    st->in_cap = freq + st->seek + st->sequence;
+    st->in = (float*)av_malloc_array((size_t)st->in_cap * channels , sizeof(float));
+    st->out = (float*)av_malloc_array((size_t)st->in_cap * channels , sizeof(float));
+    st->pack = (uint8_t*)av_malloc_array((size_t)st->in_cap * channels , sizeof(float));
+    st->mid = (float*)av_malloc_array((size_t)st->overlap * channels , sizeof(float));
+    st->fade = (float*)av_malloc_array((size_t)st->overlap * channels , sizeof(float));
+    if (!st->in || !st->out || !st->pack || !st->mid || !st->fade)
+    {
+        stretchFree(st);
+        return 0;
+    }
+    for (int i = 0; i < st->overlap; i++)
+    {
+        for (int c = 0; c < channels; c++) st->fade[i * channels + c] = (i + 0.5f) / st->overlap;
+    }
+
+    kernels = &kernelsC;
+#if defined(__x86_64__)
+    if (flags & AV_CPU_FLAG_AVX2) kernels = &kernelsAVX2;
+    else if (flags & AV_CPU_FLAG_SSE2) kernels = &kernelsSSE2;
+#elif defined(__aarch64__)
+    if (flags & AV_CPU_FLAG_NEON) kernels = &kernelsNEON;
+#else
+    (void)flags;
+#endif
+    logger(LOG , "Time stretch kernels: %s" , kernels->name);
+    return 1;
+}
+
+void stretchFree(Stretch* st)
+{
+    av_freep(&st->in);
+    av_freep(&st->out);
+    av_freep(&st->pack);
+    av_freep(&st->mid);
+    av_freep(&st->fade);
+}
+
+//play `len` bytes of PCM at `rate` and emit the result. At rate 1 the PCM is emitted as is,
+//after whatever the stretcher still held, so rate changes never flush anything
+//return the bytes taken
+int stretchProcess(Stretch* st , const uint8_t* data , int len , double rate , StretchEmit emit , void* opaque)
+{
+    int frame_size = st->bytes_per_sample * st->channels;
+    int frames = len / frame_size;
+    int n;
+    if (rate == 1.0 || !st->in)
+    {
+        if (st->active) stretchFlush(st , emit , opaque);
+        emit(opaque , data , len);
+        return len;
+    }
+    rate = av_clipd(rate , STRETCH_MIN_RATE , STRETCH_MAX_RATE);
+    st->active = true;
+    while (frames > 0)
+    {
+        n = FFMIN(frames , st->in_cap - st->in_len);
+        stretchUnpack(st , st->in + (size_t)st->in_len * st->channels , data , n);
+        st->in_len += n;
+        data += n * frame_size;
+        frames -= n;
+        while (stretchStep(st , rate , emit , opaque));
+        stretchCompact(st);
+    }
+    return len;
+}
+
+//emit everything buffered and go back to pass-through: the last piece is
+//cross-faded into the input where the next step would have searched
+void stretchFlush(Stretch* st , StretchEmit emit , void* opaque)
+{
+    int ch = st->channels;
+    int ip = FFMIN((int)st->in_pos , st->in_len);
+    int rest = st->in_len - ip;
+    if (st->have_mid && rest >= st->overlap)
+    {
+        kernels->crossfade(st->out , st->mid , st->in + (size_t)ip * ch , st->fade , st->overlap * ch);
+        memcpy(st->out + (size_t)st->overlap * ch , st->in + (size_t)(ip + st->overlap) * ch ,
+            (size_t)(rest - st->overlap) * ch * sizeof(float));
+        stretchEmit(st , st->out , rest , emit , opaque);
+    }
+    else
+    {
+        if (st->have_mid) stretchEmit(st , st->mid , st->overlap , emit , opaque);
+        stretchEmit(st , st->in + (size_t)ip * ch , rest , emit , opaque);
+    }
+    st->in_len = 0;
+    st->in_pos = 0;
+    st->out_src = 0;
+    st->have_mid = false;
+    st->active = false;
+}
+
+//drop everything buffered without emitting it, for a seek
+void stretchReset(Stretch* st)
+{
+    st->in_len = 0;
+    st->in_pos = 0;
+    st->out_src = 0;
+    st->have_mid = false;
+    st->active = false;
+}
+
+//input frames taken but not emitted yet: the PCM ring is this far behind the decoder
+int stretchPending(const Stretch* st)
+{
+    if (!st->active) return 0;
+    return (int)(st->in_len - st->out_src);
+}
@@ -0,0 +1,47 @@
+#ifndef STRETCH_H__
+#define STRETCH_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <libavutil/samplefmt.h>
+
+//WSOLA time stretch for the audio decode thread: plays PCM faster or slower
+//without changing its pitch, between the converter and the PCM ring
+
+#define STRETCH_MIN_RATE 0.25
+#define STRETCH_MAX_RATE 4.0
+#define STRETCH_SEQUENCE_MS 40 //length of one spliced piece
+#define STRETCH_SEEK_MS 15 //window searched for the best splice point
+#define STRETCH_OVERLAP_MS 8 //cross-fade at a splice
+
+//receives stretched PCM in the stretcher's sample format
+typedef void (*StretchEmit)(void* opaque , const uint8_t* data , int len);
+
+typedef struct Stretch
+{
+    enum AVSampleFormat fmt;//packed S16, S32 or FLT, in and out
+    int channels;
+    int bytes_per_sample;
+    int sequence;//frames taken from the input per step
+    int seek;
+    int overlap;
+    float* in;//interleaved float input
+    int in_cap;//in frames
+    int in_len;//frames buffered in `in`
+    double in_pos;//where the next step searches from, advances by rate per output frame
+    double out_src;//input frame where the emitted output ends
+    float* mid;//tail of the last piece, cross-faded into the next one
+    bool have_mid;
+    float* fade;//cross-fade ramp, one weight per sample of the overlap
+    float* out;//one step of output
+    uint8_t* pack;//the same in `fmt`
+    bool active;//holds input, pass-through is only safe once flushed
+}Stretch;
+
+int stretchInit(Stretch* st , enum AVSampleFormat fmt , int channels , int freq);
+void stretchFree(Stretch* st);
+int stretchProcess(Stretch* st , const uint8_t* data , int len , double rate , StretchEmit emit , void* opaque);
+void stretchFlush(Stretch* st , StretchEmit emit , void* opaque);
+void stretchReset(Stretch* st);
+int stretchPending(const Stretch* st);
+
+#endif
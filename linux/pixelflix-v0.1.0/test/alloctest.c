@@ -0,0 +1,83 @@
+//allocation test for the audio path: two generated WAV files play as a gapless playlist
+//into SDL's dummy audio driver, through the resampler (external clock), the loudness
+//normalizer and the equalizer. Built with RTCHECK_ABORT, the audio
+//decode thread aborts when decoding a packet allocates once warmed up (make check)
+#include "../logger.h"
+#include "../player.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <libavutil/time.h>
+
+#define ALLOCTEST_SECONDS 3
+#define ALLOCTEST_TIMEOUT 30.0 //seconds, playback takes twice ALLOCTEST_SECONDS
+
+static void alloctestPut(FILE* f , uint32_t v , int bytes)
+{
+    for (int i = 0; i < bytes; i++) fputc((v >> (8 * i)) & 0xff , f);
+}
+
+//a sine tone as 16 bit PCM, the rates and layouts differ so a track change rebuilds the resampler
+static void alloctestWav(const char* path , int freq , int channels)
+{
+    uint32_t frames = (uint32_t)freq * ALLOCTEST_SECONDS;
+    uint32_t size = frames * channels * 2;
+    FILE* f = fopen(path , "wb");
+    if (!f) logger(EXIT_FAILURE , "Failed to create %s." , path);
+    fputs("RIFF" , f);
+    alloctestPut(f , 36 + size , 4);
+    fputs("WAVEfmt " , f);
+    alloctestPut(f , 16 , 4);
+    alloctestPut(f , 1 , 2);//PCM
+    alloctestPut(f , channels , 2);
+    alloctestPut(f , freq , 4);
+    alloctestPut(f , freq * channels * 2 , 4);
+    alloctestPut(f , channels * 2 , 2);
+    alloctestPut(f , 16 , 2);
+    fputs("data" , f);
+    alloctestPut(f , size , 4);
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        for (int c = 0; c < channels; c++) alloctestPut(f , (uint16_t)(int16_t)lrint(8000 * sin(2 * M_PI * 440 * i / freq)) , 2);
+    }
+    fclose(f);
+}
+
+int main(void)
+{
+    PlayerOptions opts = { 0 };
+    char dir[] = "/tmp/alloctestXXXXXX";
+    char first[64] , second[64];
+    const char* playlist[1];
+    double start;
+    if (!mkdtemp(dir)) logger(EXIT_FAILURE , "Failed to create a temporary directory.");
+    snprintf(first , sizeof(first) , "%s/first.wav" , dir);
+    snprintf(second , sizeof(second) , "%s/second.wav" , dir);
+    alloctestWav(first , 48000 , 2);
+    alloctestWav(second , 44100 , 1);
+    //no sound card needed, and the loudness cache stays out of the user's
+    setenv("SDL_AUDIODRIVER" , "dummy" , 0);
+    setenv("XDG_CACHE_HOME" , dir , 1);
+
+    playlist[0] = second;
+    opts.audioOnly = true;
+    opts.master = SYNC_EXTERNAL;
+    opts.playlist = playlist;
+    opts.playlistLen = 1;
+    opts.normalize = true;
+    opts.loudnessTarget = -23;
+    opts.volume = -6;
+    opts.eq[0] = (DspBand){ .freq = 1000 , .gain = 6 , .q = 1 };
+    opts.eqBands = 1;
+    if (!playerInit(first , &opts)) logger(EXIT_FAILURE , "Failed to start the player.");
+
+    start = playerGetTime();
+    while (!player_status.isAudioDecodeFinished)
+    {
+        if (playerGetTime() - start > ALLOCTEST_TIMEOUT) logger(EXIT_FAILURE , "Audio decoding didn't finish.");
+        av_usleep(10000);
+    }
+    printf("alloctest: no allocation in the audio path's steady state.\n");
+    return 0;
+}
@@ -1,84 +1,208 @@
 #include "video.h"
 #include "player.h"
+#include "demux.h"
 #include "logger.h"
 #include <pthread.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/mem.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
 
-//video playing thread
+#define VIDEO_STATS_INTERVAL 250 //frames between two timing reports
+#define VIDEO_TEXTURE_RING 3 //one on screen, one queued for present, one being uploaded
+#define VIDEO_SPECTRUM_W 640 //visualizer window without -s
+#define VIDEO_SPECTRUM_H 240
+#define VIDEO_SPECTRUM_PERIOD (1.0 / 60) //visualizer redraw interval, seconds
 
+//pick the lowres level for a window: the largest power-of-two reduction the codec
+//supports that still leaves the decoded picture at least as big as the window.
+//0 means full resolution.
+int videoPickLowres(const AVCodec* codec , int width , int height , int win_w , int win_h)
+{
+    int lowres = 0;
+    if (!codec || win_w <= 0 || win_h <= 0) return 0;
+    while (lowres < codec->max_lowres &&
+        (width >> (lowres + 1)) >= win_w &&
+        (height >> (lowres + 1)) >= win_h)
+    {
+        lowres++;
+    }
+    return lowres;
+}
+
+//fit src_w x src_h into win_w x win_h keeping the aspect ratio, never upscaling.
+//The result is even because IYUV chroma planes are half size.
+void videoFitSize(int src_w , int src_h , int win_w , int win_h , int* out_w , int* out_h)
+{
+    int w = src_w;
+    int h = src_h;
+    if (win_w > 0 && win_h > 0 && (src_w > win_w || src_h > win_h))
+    {
+        if ((int64_t)src_w * win_h > (int64_t)src_h * win_w)//limited by width
+        {
+            w = win_w;
+            h = (int)((int64_t)src_h * win_w / src_w);
+        }
+        else//limited by height
+        {
+            h = win_h;
+            w = (int)((int64_t)src_w * win_h / src_h);
+        }
+    }
+    *out_w = FFMAX(w & ~1 , 2);
+    *out_h = FFMAX(h & ~1 , 2);
+}
+
+//the biggest rect with the texture's aspect ratio centered in the window
+void videoLetterbox(int tex_w , int tex_h , int win_w , int win_h , SDL_Rect* rect)
+{
+    if ((int64_t)tex_w * win_h > (int64_t)tex_h * win_w)
+    {
+        rect->w = win_w;
+        rect->h = (int)((int64_t)tex_h * win_w / tex_w);
+    }
+    else
+    {
+        rect->h = win_h;
+        rect->w = (int)((int64_t)tex_w * win_h / tex_h);
+    }
+    rect->x = (win_w - rect->w) / 2;
+    rect->y = (win_h - rect->h) / 2;
+}
+
+//pts of a frame in seconds, frames without one follow the previous frame
+static double videoFramePts(PlayerStatus* ps , AVFrame* frame , double prev_pts , double frame_dur)
+{
+    if (frame->best_effort_timestamp == AV_NOPTS_VALUE) return prev_pts + frame_dur;
+    return frame->best_effort_timestamp * av_q2d(ps->fmtCtx->streams[ps->v_idx]->time_base);
+}
+
+//sleep until the absolute monotonic time `deadline`, sleeping by a duration
+//would add the time spent computing it and drift frame after frame
+static void videoSleepUntil(double deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)deadline;
+    ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1000000000.0);
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC , TIMER_ABSTIME , &ts , NULL) == EINTR);
+}
+
+//record how far from its deadline a frame was presented
+static void videoFrameTiming(FrameStats* st , double deadline , double presented , double syncError)
+{
+    double lateness = presented - deadline;
+    st->jitter = st->presented ? lateness - st->lateness : 0;
+    st->lateness = lateness;
+    if (lateness > st->max_lateness) st->max_lateness = lateness;
+    st->sum_jitter += fabs(st->jitter);
+    st->syncError = syncError;
+    if (fabs(syncError) > st->max_syncError) st->max_syncError = fabs(syncError);
+    st->sum_syncError += fabs(syncError);
+    st->presented++;
+    if (st->presented % VIDEO_STATS_INTERVAL == 0)
+    {
+        logger(LOG , "Video timing: %llu presented, %llu dropped, lateness %.3f ms (max %.3f ms), mean jitter %.3f ms" ,
+            (unsigned long long)st->presented , (unsigned long long)st->dropped ,
+            st->lateness * 1000 , st->max_lateness * 1000 , st->sum_jitter / st->presented * 1000);
+        logger(LOG , "A/V sync error: %.3f ms (max %.3f ms, mean %.3f ms)" ,
+            st->syncError * 1000 , st->max_syncError * 1000 , st->sum_syncError / st->presented * 1000);
+    }
+}
+
+//lock a whole IYUV streaming texture and point data/linesize at its three planes.
+//SDL lays them out as Y (pitch x h), then U and V (pitch/2 x h/2).
+//1 on success, 0 if the renderer can't lock it; unlock with SDL_UnlockTexture
+static int videoLockPlanes(SDL_Texture* texture , int h , uint8_t* data[4] , int linesize[4])
+{
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture , NULL , &pixels , &pitch)) return 0;
+    data[0] = (uint8_t*)pixels;
+    data[1] = data[0] + pitch * h;
+    data[2] = data[1] + (pitch / 2) * ((h + 1) / 2);
+    data[3] = NULL;
+    linesize[0] = pitch;
+    linesize[1] = pitch / 2;
+    linesize[2] = pitch / 2;
+    linesize[3] = 0;
+    return 1;
+}
+
+//video render thread
+//1. dequeue frame from vfq
+//2. convert it to the output size, directly into the locked texture
+//3. sleep until the frame's deadline on the master clock
+//4. present
 void* videoPlaying(void* arg)
 {
 
     PlayerStatus* ps = (PlayerStatus*)arg;
 
     AVCodecContext* p_avcodec_ctx = ps->v_codecCtx;
-    Queue* vpq = &ps->vpq;
+    Queue* vfq = &ps->vfq;
 
     AVFrame* p_avframe_raw = NULL;
     AVFrame* p_avframe_yuv = NULL;
-    AVPacket* p_avpacket = NULL;
-    SDL_Event* event = NULL;
 
-    struct SwsContext* p_sws_ctx;
+    struct SwsContext* p_sws_ctx = NULL;
     SDL_Window* win;
     SDL_Renderer* renderer;
+    SDL_Texture* textures[VIDEO_TEXTURE_RING] = { NULL };
     SDL_Texture* texture;
+    int write_idx = 0;//next texture to upload into
+    int ready_idx = -1;//newest uploaded texture, the one to present
     SDL_Rect rect;
 
     int buf_size;
     int ret = 0;
-    uint8_t* buffer;
+    uint8_t* buffer = NULL;
+    int win_w , win_h;//actual window size
+    int out_w = 0 , out_h = 0;//size of the converted frame and of the texture
+    int frm_w , frm_h;
+    double pts = 0;
+    double deadline;
+    double master;
+    double presented;
+    int serial;
+    int shown = 0;//serial of the last frame presented
+    double pausedSeen = 0;//pausedTotal the video clock was shifted by
+    AVRational frameRate = av_guess_frame_rate(ps->fmtCtx , ps->fmtCtx->streams[ps->v_idx] , NULL);
+    double frame_dur = frameRate.num > 0 ? av_q2d(av_inv_q(frameRate)) : 0.04;
+    AVFrame* next;
 
-    p_avframe_raw = av_frame_alloc();
     p_avframe_yuv = av_frame_alloc();
-    if (!p_avframe_raw || !p_avframe_yuv)
+    if (!p_avframe_yuv)
     {
         printf("Failed to allocate an avframe.\n");
         exit(EXIT_FAILURE);
     }
-    buf_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P ,
-        p_avcodec_ctx->width ,
-        p_avcodec_ctx->height ,
-        1);//last para means align,1 means no align ,4 means 4 bytes align etc.
-    // printf("buf_size: %d\n", buf_size);
-    buffer = (uint8_t*)av_malloc(buf_size);//buffer is a pointer, buffer++ means moving to next bytes.
-
-    av_image_fill_arrays(p_avframe_yuv->data ,
-        p_avframe_yuv->linesize ,
-        buffer ,
-        AV_PIX_FMT_YUV420P ,
-        p_avcodec_ctx->width ,
-        p_avcodec_ctx->height ,
-        1
-    );
 
-    //initilize sws context
-    p_sws_ctx = sws_getContext(p_avcodec_ctx->width ,
-        p_avcodec_ctx->height ,
-        p_avcodec_ctx->pix_fmt ,//src fmt
-        p_avcodec_ctx->width ,
-        p_avcodec_ctx->height ,
-        AV_PIX_FMT_YUV420P ,
-        SWS_BICUBIC ,
-        NULL ,
-        NULL ,
-        NULL
-    );
-    if (!p_sws_ctx)
+    //with fitWindow the window is the tile size, otherwise the video size
+    if (ps->opts.fitWindow)
     {
-        printf("Falied to initilize sws context.\n");
-        exit(EXIT_FAILURE);
+        win_w = ps->opts.win_w;
+        win_h = ps->opts.win_h;
+    }
+    else
+    {
+        win_w = p_avcodec_ctx->width;
+        win_h = p_avcodec_ctx->height;
     }
-
     win = SDL_CreateWindow(
         "PixelFlix 简易视频播放器" ,
         SDL_WINDOWPOS_UNDEFINED ,
         SDL_WINDOWPOS_UNDEFINED ,
-        p_avcodec_ctx->width ,
-        p_avcodec_ctx->height ,
-        SDL_WINDOW_OPENGL
+        win_w ,
+        win_h ,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
     );
     if (!win)
     {
@@ -91,72 +215,200 @@ void* videoPlaying(void* arg)
         printf("Failed to create a renderer.\n");
         exit(EXIT_FAILURE);
     }
-    texture = SDL_CreateTexture(
-        renderer ,
-        SDL_PIXELFORMAT_IYUV ,
-        SDL_TEXTUREACCESS_STREAMING ,
-        p_avcodec_ctx->width ,
-        p_avcodec_ctx->height
-    );
-    if (!texture)
-    {
-        printf("Failed to create a renderer.\n");
-        exit(EXIT_FAILURE);
-    }
-    rect.x = 0;
-    rect.y = 0;
-    rect.w = p_avcodec_ctx->width;
-    rect.h = p_avcodec_ctx->height;
 
-
-    // read packet from stream
-    // one packet contains one video frame or audio frame
-    p_avpacket = av_packet_alloc();
-    if (!p_avpacket) logger(EXIT_FAILURE , "Failed to alloc packet.");
     while (1)
     {
-        // dequeue a video packet
-        ret = vpq->dequeue(vpq , (void**)&p_avpacket);
+        playerWaitPaused(ps);
+        // dequeue a decoded video frame
+        ret = vfq->dequeue(vfq , (void**)&p_avframe_raw);
         if (ret != 1)
         {
+            if (ps->isVideoDecodeFinished) break;
+            continue;
+        }
+        // a frame from before a seek that was still on its way
+        serial = (int)(intptr_t)p_avframe_raw->opaque;
+        if (serial != atomic_load(&ps->serial))
+        {
+            av_frame_free(&p_avframe_raw);
             continue;
         }
+        // deadline = monotonic time at which the master clock reaches the frame's pts
+        pts = videoFramePts(ps , p_avframe_raw , pts , frame_dur);
+        playerStartClock(ps , pts);
+        master = playerMasterClock(ps);
+        deadline = playerGetTime() + (pts - master) / playerGetSpeed(ps);
+        atomic_store(&ps->renderDeadline , deadline);
+        // more than a frame late and a newer frame is waiting: skip the conversion and drop it.
+        // The first frame of a timeline is the one a seek asked for, it is always shown
+        if (serial == shown && master - pts > frame_dur && vfq->peek(vfq , (void**)&next))
+        {
+            ps->vstats.dropped++;
+            av_frame_free(&p_avframe_raw);
+            continue;
+        }
+        // lowres frames are already smaller than the coded size, so use the frame's own size
+        frm_w = p_avframe_raw->width;
+        frm_h = p_avframe_raw->height;
 
-    }
-    sws_scale(p_sws_ctx ,
-        (const uint8_t* const*)p_avframe_raw->data ,
-        p_avframe_raw->linesize ,
-        0 ,
-        p_avcodec_ctx->height ,
-        p_avframe_yuv->data ,
-        p_avframe_yuv->linesize
-    );
-    SDL_UpdateYUVTexture(texture ,
-        &rect ,
-        p_avframe_yuv->data[0] ,
-        p_avframe_yuv->linesize[0] ,
-        p_avframe_yuv->data[1] ,
-        p_avframe_yuv->linesize[1] ,
-        p_avframe_yuv->data[2] ,
-        p_avframe_yuv->linesize[2]
-    );
-    SDL_RenderClear(renderer);
-    SDL_RenderCopy(renderer ,
-        texture ,
-        NULL ,
-        &rect
-    );
+        //the output size follows the actual window, so a thumbnail tile never gets a full size texture
+        SDL_GetWindowSize(win , &win_w , &win_h);
+        if (ps->opts.fitWindow) videoFitSize(frm_w , frm_h , win_w , win_h , &win_w , &win_h);
+        else videoFitSize(frm_w , frm_h , 0 , 0 , &win_w , &win_h);//full size, SDL scales it on present
+        if (win_w != out_w || win_h != out_h)
+        {
+            out_w = win_w;
+            out_h = win_h;
+            logger(LOG , "Video output size: %dx%d (frame %dx%d)" , out_w , out_h , frm_w , frm_h);
 
-    SDL_RenderPresent(renderer);
+            //the staging buffer is only needed if the texture can't be locked
+            av_freep(&buffer);
+
+            for (int i = 0; i < VIDEO_TEXTURE_RING; i++)
+            {
+                if (textures[i]) SDL_DestroyTexture(textures[i]);
+                textures[i] = SDL_CreateTexture(
+                    renderer ,
+                    SDL_PIXELFORMAT_IYUV ,
+                    SDL_TEXTUREACCESS_STREAMING ,
+                    out_w ,
+                    out_h
+                );
+                if (!textures[i])
+                {
+                    printf("Failed to create a texture.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            write_idx = 0;
+            ready_idx = -1;
+        }
+        //upload into a texture the GPU is not reading from, the one on screen stays untouched
+        texture = textures[write_idx];
+
+        //scale once, straight from the decoded size to the output size
+        p_sws_ctx = sws_getCachedContext(p_sws_ctx ,
+            frm_w ,
+            frm_h ,
+            (enum AVPixelFormat)p_avframe_raw->format ,//src fmt
+            out_w ,
+            out_h ,
+            AV_PIX_FMT_YUV420P ,
+            SWS_BICUBIC ,
+            NULL ,
+            NULL ,
+            NULL
+        );
+        if (!p_sws_ctx)
+        {
+            printf("Falied to initilize sws context.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (videoLockPlanes(texture , out_h , p_avframe_yuv->data , p_avframe_yuv->linesize))
+        {
+            //convert straight into the texture memory, no staging copy
+            sws_scale(p_sws_ctx ,
+                (const uint8_t* const*)p_avframe_raw->data ,
+                p_avframe_raw->linesize ,
+                0 ,
+                frm_h ,
+                p_avframe_yuv->data ,
+                p_avframe_yuv->linesize
+            );
+            SDL_UnlockTexture(texture);
+        }
+        else
+        {
+            if (!buffer)
+            {
+                buf_size = av_image_get_buffer_size(AV_PIX_FMT_YUV420P , out_w , out_h , 1);//last para means align,1 means no align ,4 means 4 bytes align etc.
+                buffer = (uint8_t*)av_malloc(buf_size);//buffer is a pointer, buffer++ means moving to next bytes.
+                if (!buffer) logger(EXIT_FAILURE , "Failed to alloc yuv buffer.");
+            }
+            av_image_fill_arrays(p_avframe_yuv->data ,
+                p_avframe_yuv->linesize ,
+                buffer ,
+                AV_PIX_FMT_YUV420P ,
+                out_w ,
+                out_h ,
+                1
+            );
+            sws_scale(p_sws_ctx ,
+                (const uint8_t* const*)p_avframe_raw->data ,
+                p_avframe_raw->linesize ,
+                0 ,
+                frm_h ,
+                p_avframe_yuv->data ,
+                p_avframe_yuv->linesize
+            );
+            SDL_UpdateYUVTexture(texture ,
+                NULL ,
+                p_avframe_yuv->data[0] ,
+                p_avframe_yuv->linesize[0] ,
+                p_avframe_yuv->data[1] ,
+                p_avframe_yuv->linesize[1] ,
+                p_avframe_yuv->data[2] ,
+                p_avframe_yuv->linesize[2]
+            );
+        }
+        av_frame_free(&p_avframe_raw);
+        ready_idx = write_idx;
+        write_idx = (write_idx + 1) % VIDEO_TEXTURE_RING;
+        //center the picture, SDL stretches it if the window is bigger than the texture
+        SDL_GetWindowSize(win , &win_w , &win_h);
+        videoLetterbox(out_w , out_h , win_w , win_h , &rect);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer ,
+            textures[ready_idx] ,
+            NULL ,
+            &rect
+        );
+
+        //paused while this frame was prepared: it is presented on the clocks as they resume
+        if (playerWaitPaused(ps))
+        {
+            deadline = playerGetTime() + (pts - playerMasterClock(ps)) / playerGetSpeed(ps);
+            atomic_store(&ps->renderDeadline , deadline);
+        }
+        //the time spent paused doesn't count on the video clock, this thread is its writer
+        if (atomic_load(&ps->pausedTotal) != pausedSeen)
+        {
+            playerClockShift(&ps->videoClock , atomic_load(&ps->pausedTotal) - pausedSeen);
+            pausedSeen = atomic_load(&ps->pausedTotal);
+        }
+        //the upload is done ahead of time, only the present waits for the deadline
+        videoSleepUntil(deadline);
+        SDL_RenderPresent(renderer);
+        presented = playerGetTime();
+        atomic_store(&ps->presentedAt , presented);
+        //a key was waiting for this frame: the event loop logs its latency
+        if (atomic_load(&ps->inputPending) && (ps->inputSerial < 0 || serial != ps->inputSerial) &&
+            atomic_exchange(&ps->inputPending , false))
+            playerWake(ps , PLAYER_WAKE_FRAME);
+        //the frame's sync error is the video clock's drift from the master; with video as
+        //the master it is measured against the audio clock instead
+        //shown by a seek made while paused, the clock stays frozen at the frame
+        playerClockSet(ps , &ps->videoClock , pts , atomic_load(&ps->paused) ? ps->pausedAt : presented , playerGetSpeed(ps) , serial);
+        if (serial != shown && atomic_exchange(&ps->seekReport , false))
+            logger(LOG , "Seek to %.3f s took %.1f ms, %llu frames decoded and dropped on the way." ,
+                pts , (presented - ps->seekAt) * 1000 , (unsigned long long)ps->seekDropped);
+        shown = serial;
+        playerSeekShown(ps , serial);
+        videoFrameTiming(&ps->vstats , deadline , presented ,
+            ps->master == SYNC_VIDEO ? -atomic_load(&ps->audioClock.drift) : atomic_load(&ps->videoClock.drift));
+    }
 
-    SDL_WaitEvent(event);
     // close file
-    SDL_Quit();
+    for (int i = 0; i < VIDEO_TEXTURE_RING; i++)
+    {
+        if (textures[i]) SDL_DestroyTexture(textures[i]);
+    }
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(win);
     sws_freeContext(p_sws_ctx);
     av_free(buffer);
     av_frame_free(&p_avframe_yuv);
-    av_frame_free(&p_avframe_raw);
-    avcodec_free_context(&p_avcodec_ctx);
+    playerWake(ps , PLAYER_WAKE_END);
     return NULL;
 
 }
@@ -167,44 +419,87 @@ void* videoDecode(void* arg)
 {
     PlayerStatus* ps = (PlayerStatus*)arg;
     AVCodecContext* v_codecCtx = ps->v_codecCtx;
+    Queue* vpq = &ps->vpq;
+    Queue* vfq = &ps->vfq;
     AVPacket* pkt = NULL;
     AVFrame* raw_frame;
-    AVFrame* yuv_frame;
+    AVFrame* frame;
+
+    AVRational tb = ps->fmtCtx->streams[ps->v_idx]->time_base;
+    AVRational frameRate = av_guess_frame_rate(ps->fmtCtx , ps->fmtCtx->streams[ps->v_idx] , NULL);
+    double frame_dur = frameRate.num > 0 ? av_q2d(av_inv_q(frameRate)) : 0.04;
+    double target = NAN;//a seek's target, frames ending before it are dropped
+    double pts , dur;
+    int serial = 0;//timeline of the frames decoded, from the seek markers
 
     int ret;
-    pkt = av_packet_alloc();
     raw_frame = av_frame_alloc();
-    yuv_frame = av_frame_alloc();
-    if (!pkt) logger(EXIT_FAILURE , "Failed to alloc packet.");
     if (!raw_frame) logger(EXIT_FAILURE , "Failed to alloc raw_frame.");
-    if (!yuv_frame) logger(EXIT_FAILURE , "Failed to alloc yuv_frame.");
     while (1)
     {
-        //1 send video packet to codec context
+        playerWaitPaused(ps);
+        //1 dequeue a video packet, NULL flushes the decoder once the stream is over
+        if (!vpq->dequeue(vpq , (void**)&pkt))
+        {
+            if (!ps->isStreamFinished || !demuxDrain(ps)) continue;
+            pkt = NULL;
+        }
+        //the demuxer seeked: drop the decoder's references and the frames not shown yet
+        if (pkt && pkt->stream_index == PACKET_SEEK)
+        {
+            avcodec_flush_buffers(v_codecCtx);
+            vfq->flush(vfq , &ps->pktPool);
+            target = pkt->pts / 1000000.0;
+            serial = (int)pkt->pos;
+            ps->seekDropped = 0;
+            packetPoolPut(&ps->pktPool , pkt);
+            continue;
+        }
+        //2 send video packet to codec context
         ret = avcodec_send_packet(v_codecCtx , pkt);
-        if (ret != 0)//failed to send packet to codecCtx
+        if (pkt) packetPoolPut(&ps->pktPool , pkt);
+        if (ret != 0 && ret != AVERROR(EAGAIN))
         {
             if (ret == AVERROR_EOF)
             {
                 logger(LOG , "All video packets have been dequeued.");
-                av_packet_unref(pkt);
                 break;
-
             }
-            else
+            logger(LOG , "Failed to send packet to v_codecCtx.");
+            continue;
+        }
+        //3 receive every video frame the packet produced
+        while ((ret = avcodec_receive_frame(v_codecCtx , raw_frame)) == 0)
+        {
+            //decode to the target: a frame is kept once the target falls before its end
+            if (!isnan(target) && raw_frame->best_effort_timestamp != AV_NOPTS_VALUE)
             {
-                logger(LOG , "Failed to send packet to v_codecCtx.");
-                av_packet_unref(pkt);
-                break;
+                pts = raw_frame->best_effort_timestamp * av_q2d(tb);
+                dur = raw_frame->pkt_duration > 0 ? raw_frame->pkt_duration * av_q2d(tb) : frame_dur;
+                if (pts + dur <= target + 1e-6)
+                {
+                    ps->seekDropped++;
+                    av_frame_unref(raw_frame);
+                    continue;
+                }
+                target = NAN;
             }
+            raw_frame->opaque = (void*)(intptr_t)serial;
+            frame = av_frame_alloc();
+            if (!frame) logger(EXIT_FAILURE , "Failed to alloc frame.");
+            av_frame_move_ref(frame , raw_frame);
+            vfq->enqueue(vfq , frame);
+        }
+        if (ret == AVERROR_EOF)
+        {
+            logger(LOG , "All video frames have been decoded.");
+            break;
         }
-        //2 receive a video frame from codec context
-        ret = avcodec_receive_frame(v_codecCtx , raw_frame);
-        if (ret) logger(EXIT_FAILURE , "Failed to receive frame from v_codecCtx.");
-
     }
-
-
+    av_frame_free(&raw_frame);
+    ps->isVideoDecodeFinished = true;
+    vfq->wakeup(vfq);
+    return NULL;
 }
 
 int videoDisplay(PlayerStatus* ps)
@@ -220,5 +515,67 @@ int openVideo(PlayerStatus* ps)
     pthread_create(&videoDecodeThread , NULL , videoDecode , ps);
     pthread_create(&videoPlayingThread , NULL , videoPlaying , ps);
 
+    return 1;
+}
+
+//visualizer render thread for audio only playback: draws the analyzer's band levels
+//as bars. It only reads the published levels, the audio path never waits for it
+void* videoSpectrum(void* arg)
+{
+    PlayerStatus* ps = (PlayerStatus*)arg;
+    SDL_Window* win;
+    SDL_Renderer* renderer;
+    SDL_Rect bars[SPECTRUM_BANDS];
+    float bands[SPECTRUM_BANDS];
+    int win_w , win_h , bar_w , h;
+    double deadline = playerGetTime();
+
+    win = SDL_CreateWindow(
+        "PixelFlix 简易视频播放器" ,
+        SDL_WINDOWPOS_UNDEFINED ,
+        SDL_WINDOWPOS_UNDEFINED ,
+        ps->opts.win_w > 0 ? ps->opts.win_w : VIDEO_SPECTRUM_W ,
+        ps->opts.win_h > 0 ? ps->opts.win_h : VIDEO_SPECTRUM_H ,
+        SDL_WINDOW_RESIZABLE
+    );
+    if (!win) logger(EXIT_FAILURE , "Failed to create the visualizer window.");
+    renderer = SDL_CreateRenderer(win , -1 , 0);
+    if (!renderer) logger(EXIT_FAILURE , "Failed to create the visualizer renderer.");
+
+    while (!(ps->isAudioDecodeFinished && ringFill(&ps->pcm) == 0))
+    {
+        //the bars hold still while paused, the period starts over on resume
+        if (playerWaitPaused(ps)) deadline = playerGetTime();
+        SDL_GetWindowSize(win , &win_w , &win_h);
+        bar_w = win_w / SPECTRUM_BANDS;
+        if (!spectrumRead(&ps->spectrum , bands)) memset(bands , 0 , sizeof(bands));
+        for (int b = 0; b < SPECTRUM_BANDS; b++)
+        {
+            h = (int)(bands[b] * win_h);
+            bars[b].x = b * bar_w + 1;
+            bars[b].y = win_h - h;
+            bars[b].w = bar_w > 2 ? bar_w - 2 : 1;
+            bars[b].h = h;
+        }
+        SDL_SetRenderDrawColor(renderer , 0 , 0 , 0 , 255);
+        SDL_RenderClear(renderer);
+        SDL_SetRenderDrawColor(renderer , 48 , 192 , 255 , 255);
+        SDL_RenderFillRects(renderer , bars , SPECTRUM_BANDS);
+
+        //fixed redraw rate, restart the schedule after a stall instead of catching up
+        deadline += VIDEO_SPECTRUM_PERIOD;
+        if (deadline < playerGetTime()) deadline = playerGetTime();
+        videoSleepUntil(deadline);
+        SDL_RenderPresent(renderer);
+    }
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(win);
+    return NULL;
+}
+
+int openVisualizer(PlayerStatus* ps)
+{
+    pthread_t videoSpectrumThread;
+    pthread_create(&videoSpectrumThread , NULL , videoSpectrum , ps);
     return 1;
 }
\ No newline at end of file
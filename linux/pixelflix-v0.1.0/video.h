@@ -3,5 +3,9 @@
 #include "player.h"
 
 int openVideo(PlayerStatus* ps);
+int openVisualizer(PlayerStatus* ps);
+int videoPickLowres(const AVCodec* codec , int width , int height , int win_w , int win_h);
+void videoFitSize(int src_w , int src_h , int win_w , int win_h , int* out_w , int* out_h);
+void videoLetterbox(int tex_w , int tex_h , int win_w , int win_h , SDL_Rect* rect);
 
 #endif
\ No newline at end of file